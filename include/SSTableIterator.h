@@ -1,24 +1,97 @@
 #pragma once
 #include "sstable.h"
-#include <fstream>
+#include "tablecache.h"
+#include "iterator.h"
+#include <memory>
+#include <string_view>
+#include <vector>
 
+// Walks every entry of a table in key order straight out of its mapped file,
+// one data block at a time, versions of a key newest first. key() and value()
+// stay valid until next().
 class SSTableIterator
 {
 public:
+    SSTableIterator(std::shared_ptr<TableReader> table, int fileId);
+
     SSTableIterator(const std::string &filename, int fileId);
 
+    // Positions at the first entry with key >= target, skipping the blocks before it
+    void seek(std::string_view target);
+
     void next();
 
     bool hasNext();
 
-    std::string key() const;
-    std::string value() const;
+    std::string_view key() const;
+    std::string_view value() const;
+    ValueType type() const;
+    uint64_t sequence() const;
     int getFileId() const;
 
+    // False if the table could not be opened or a block failed its checksum or
+    // did not parse; the iteration then ended early
+    bool ok() const;
+
 private:
-    std::ifstream file;
-    std::string current_key;
-    std::string current_value;
+    void init();
+    void openBlock(const IndexEntry &entry);
+    void skipExhaustedBlocks();
+
+    std::shared_ptr<TableReader> table;
+    std::vector<IndexEntry> blocks;
+    size_t block_index;
+    BlockContents contents;
+    std::unique_ptr<BlockIterator> block;
     int file_id;
-    bool is_valid;
-};
\ No newline at end of file
+    bool corrupt;
+};
+
+// Seekable, bidirectional iterator over one table, using its sparse index to
+// jump to the right block. Each visited block is decoded into an entry array
+// (prefix-compressed keys are expanded) so prev() within a block is O(1).
+// Only the newest version of each key as of snapshot is visited, and none if
+// one of the table's own range_tombstones hides it at snapshot.
+// The caller keeps index and range_tombstones alive.
+class TableIterator : public InternalIterator
+{
+public:
+    TableIterator(std::shared_ptr<TableReader> table, const std::vector<IndexEntry> *index, uint64_t snapshot = MAX_SEQUENCE_NUMBER,
+                  const std::vector<RangeTombstone> *range_tombstones = nullptr);
+
+    bool valid() const override;
+    void seekToFirst() override;
+    void seekToLast() override;
+    void seek(std::string_view target) override;
+    void next() override;
+    void prev() override;
+
+    std::string_view key() const override;
+    std::string_view value() const override;
+    ValueType type() const override;
+    bool ok() const override;
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::string_view value;
+        ValueType type;
+    };
+
+    void loadBlock(size_t block);
+    void skipEmptyBlocksForward();
+    void skipEmptyBlocksBackward();
+
+    std::shared_ptr<TableReader> table;
+    const std::vector<IndexEntry> *index;
+    uint64_t snapshot;
+    const std::vector<RangeTombstone> *range_tombstones;
+    size_t block_index;
+    // Keeps a decompressed block alive while entries point into it
+    BlockContents contents;
+    std::vector<Entry> entries;
+    size_t position;
+    // A visited block failed to read or parse and was skipped
+    bool corrupt = false;
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+// Bump allocator that hands out memory from large blocks. Allocation is safe
+// from concurrent threads; nothing is freed individually, every block is
+// released at once when the arena is destroyed.
+class Arena
+{
+public:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    Arena();
+
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // Returns 8-byte aligned memory
+    char *allocate(size_t bytes);
+
+    // Exact number of bytes this arena has obtained from the heap
+    size_t memoryUsage() const;
+
+private:
+    struct Block
+    {
+        size_t capacity;
+        std::atomic<size_t> used;
+        char *data;
+    };
+
+    Block *newBlock(size_t capacity);
+
+    std::atomic<Block *> current;
+    std::vector<Block *> blocks;
+    std::mutex blocks_mutex;
+    std::atomic<size_t> memory_usage;
+};
@@ -0,0 +1,94 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "format.h"
+
+// Data block layout (format version 7):
+//
+//   entry*  [fixed32 restart offset]*  [fixed32 num_restarts]
+//   entry = [varint32 shared][varint32 non_shared][varint32 value_len][key delta][varint64 tag][value]
+//   tag   = (sequence << 8) | type
+//
+// A key may appear several times, once per version, newest (highest sequence)
+// first. Version 6 stores a single type byte instead of the tag; versions 3-5
+// have neither and a deletion there is the value "TOMBSTONE".
+// Each key stores only the suffix it does not share with the previous key.
+// Every restart_interval entries the full key is written and its offset is
+// recorded in the restart array, so a lookup binary-searches the restarts and
+// decodes at most restart_interval entries.
+class BlockBuilder
+{
+public:
+    static const int DEFAULT_RESTART_INTERVAL = 16;
+
+    explicit BlockBuilder(int restart_interval = DEFAULT_RESTART_INTERVAL);
+
+    // Keys must be added in ascending order, versions of one key by descending sequence
+    void add(std::string_view key, std::string_view value, ValueType type, uint64_t sequence);
+
+    // Appends the restart array; the builder must be reset before reuse
+    std::string_view finish();
+
+    void reset();
+
+    bool empty() const;
+
+    // Size of the block if finished now
+    size_t sizeEstimate() const;
+
+private:
+    int restart_interval;
+    std::string buffer;
+    std::vector<uint32_t> restarts;
+    int counter;
+    std::string last_key;
+};
+
+// Forward cursor over one data block. Blocks of format version 3 and later use
+// the restart array; older versions hold plain [int key_len][key][int value_len][value]
+// records and are scanned linearly. Blocks written before entry types existed
+// report their "TOMBSTONE" values as deletions, and entries without a sequence
+// report 0.
+class BlockIterator
+{
+public:
+    BlockIterator(std::string_view contents, uint32_t format_version);
+
+    bool valid() const;
+    void seekToFirst();
+    // Positions at the first entry with key >= target (its newest version)
+    void seek(std::string_view target);
+    void next();
+
+    std::string_view key() const;
+    std::string_view value() const;
+    ValueType type() const;
+    uint64_t sequence() const;
+
+    // False if the block was malformed
+    bool ok() const;
+
+private:
+    bool parseNext();
+    void seekToRestart(uint32_t index);
+    uint32_t restartOffset(uint32_t index) const;
+
+    std::string_view data;
+    bool prefix_encoded;
+    bool typed;
+    bool sequenced;
+    uint32_t restarts_offset;
+    uint32_t num_restarts;
+
+    // Offset of the next entry to decode
+    size_t next_offset;
+    std::string current_key;
+    std::string_view current_key_view;
+    std::string_view current_value;
+    ValueType current_type;
+    uint64_t current_sequence;
+    bool is_valid;
+    bool corrupt;
+};
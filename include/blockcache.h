@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+// Byte-bounded cache of SSTable data blocks keyed by (file id, block offset).
+// Keys are spread over independently locked shards, each evicting in LRU
+// order. Blocks are handed out as shared_ptr, so an evicted block stays valid
+// for readers that still hold it.
+class BlockCache
+{
+public:
+    using Block = std::shared_ptr<const std::string>;
+
+    static const int DEFAULT_NUM_SHARDS = 16;
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t usage = 0;
+        size_t capacity = 0;
+    };
+
+    explicit BlockCache(size_t capacity, int numShards = DEFAULT_NUM_SHARDS);
+
+    BlockCache(const BlockCache &) = delete;
+    BlockCache &operator=(const BlockCache &) = delete;
+
+    // Returns nullptr on a miss
+    Block lookup(uint64_t file_id, uint64_t offset);
+
+    void insert(uint64_t file_id, uint64_t offset, Block block);
+
+    Stats stats() const;
+
+private:
+    struct Entry
+    {
+        uint64_t file_id;
+        uint64_t offset;
+        Block block;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const std::pair<uint64_t, uint64_t> &key) const;
+    };
+
+    // Front of lru is the most recently used entry
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<std::pair<uint64_t, uint64_t>, std::list<Entry>::iterator, KeyHash> map;
+        size_t usage = 0;
+        size_t capacity = 0;
+    };
+
+    Shard &shardFor(uint64_t file_id, uint64_t offset);
+
+    size_t capacity;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+};
@@ -1,20 +1,50 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <string_view>
+#include <cstdint>
 
+// Cache-line-blocked bloom filter. Each key hashes once (64-bit) to select a
+// 512-bit block and derives all of its probes from the same hash, so a lookup
+// touches exactly one 64-byte cache line and performs no allocation.
 class BloomFilter
 {
 public:
-    BloomFilter(size_t numKeys, int k = 3);
+    static const int DEFAULT_BITS_PER_KEY = 10;
 
-    void add(const std::string &key);
+    // An empty filter that reports every key as possibly present
+    BloomFilter();
 
-    bool contains(const std::string &key) const;
+    // Sizes the filter for numKeys keys and picks the number of probes that
+    // minimises the false-positive rate for the given bits per key
+    BloomFilter(size_t numKeys, int bitsPerKey = DEFAULT_BITS_PER_KEY);
+
+    void add(std::string_view key);
+
+    bool contains(std::string_view key) const;
+
+    // Probes count keys at once; every key's cache line is prefetched before any is tested
+    void containsMany(const std::string_view *keys, size_t count, bool *results) const;
+
+    // Serialized form stored in an SSTable filter block
+    std::string encode() const;
+
+    // Fails on filters written in the pre-blocked format; callers fall back to an empty filter
+    static bool decode(std::string_view data, BloomFilter &out);
+
+    size_t numBits() const;
 
 private:
-    std::vector<bool> bits;
+    // One block is one 64-byte cache line of 512 bits; std::allocator honours the alignment
+    struct alignas(64) CacheLine
+    {
+        uint64_t words[8];
+    };
+
+    static uint64_t hash(std::string_view key);
 
-    std::vector<size_t> getHashIndices(const std::string &key) const;
+    const CacheLine &blockFor(uint64_t h) const;
 
+    std::vector<CacheLine> blocks;
     int k;
-};
\ No newline at end of file
+};
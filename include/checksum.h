@@ -3,7 +3,18 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
 
+// CRC-32 (IEEE), table driven. Only used to check WAL records written before CRC-32C.
 uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t len);
 uint32_t crc32(const uint8_t* data, size_t len);
-uint32_t crc32(const std::string& s);
\ No newline at end of file
+uint32_t crc32(const std::string& s);
+
+// CRC-32C (Castagnoli). Runs on the SSE4.2 crc32 instruction when the CPU has it and
+// falls back to slicing-by-8 tables otherwise; the choice is made once at startup.
+uint32_t crc32c_update(uint32_t crc, const uint8_t* data, size_t len);
+uint32_t crc32c(const uint8_t* data, size_t len);
+uint32_t crc32c(std::string_view s);
+
+// True if crc32c runs on the hardware instruction
+bool crc32c_hardware();
@@ -0,0 +1,88 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include "version.h"
+
+struct KVStoreOptions;
+
+// Tables one compaction merges and the level its output goes to. The inputs
+// are every table the output replaces, so the compaction owns the levels from
+// level through output_level until it installs its edit.
+struct Compaction
+{
+    // Newest level an input comes from
+    int level = 0;
+    int output_level = 1;
+    // Each input with the level it is read from
+    std::vector<std::pair<TableHandle, int>> inputs;
+    // Nothing below output_level can hold an older version of an output key, so
+    // deletions that shadow nothing else may be dropped
+    bool bottommost = false;
+};
+
+// Decides when the store compacts and which tables each compaction takes.
+// KVStore serializes every call under its levels_mutex.
+class CompactionPicker
+{
+public:
+    virtual ~CompactionPicker() = default;
+
+    // Levels with a compaction due, most urgent first
+    virtual std::vector<int> levelsToCompact(const Version &version) const = 0;
+
+    // Chooses the inputs of a compaction scheduled for level; false if there is
+    // nothing to compact there any more
+    virtual bool pickCompaction(const Version &version, int level, Compaction &compaction) = 0;
+};
+
+// Levels 1 and deeper have byte targets growing by a fixed multiplier. Each level
+// is scored against its target (level 0 by table count) and a level over it gives
+// up its tables one at a time, taking turns through its key space, merged with
+// the tables they overlap in the next level.
+class LeveledCompactionPicker : public CompactionPicker
+{
+public:
+    explicit LeveledCompactionPicker(const KVStoreOptions &options);
+
+    std::vector<int> levelsToCompact(const Version &version) const override;
+    bool pickCompaction(const Version &version, int level, Compaction &compaction) override;
+
+private:
+    uint64_t maxBytesForLevel(int level) const;
+    // 1 or more when the level needs compaction
+    double score(const Version &version, int level) const;
+
+    const KVStoreOptions &options;
+    // Per level, the largest key of the table it last gave up
+    std::vector<std::string> cursor;
+};
+
+// Size-tiered compaction. Every level 0 table is a sorted run, newest first, and
+// each non-empty deeper level holds one older run. Runs of similar size are merged
+// once there are level0_compaction_trigger of them, so data is rewritten about
+// once per tier instead of once per level. Everything is merged into one run
+// when the newer runs outgrow the oldest by universal_max_size_amplification_percent.
+class UniversalCompactionPicker : public CompactionPicker
+{
+public:
+    explicit UniversalCompactionPicker(const KVStoreOptions &options);
+
+    std::vector<int> levelsToCompact(const Version &version) const override;
+    bool pickCompaction(const Version &version, int level, Compaction &compaction) override;
+
+private:
+    struct SortedRun
+    {
+        int level;
+        std::vector<TableHandle> tables;
+        uint64_t bytes;
+    };
+
+    static std::vector<SortedRun> sortedRuns(const Version &version);
+
+    const KVStoreOptions &options;
+};
+
+std::unique_ptr<CompactionPicker> newCompactionPicker(const KVStoreOptions &options);
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <cstdint>
+
+// Codec of a stored data block, written as the block trailer byte
+enum class CompressionType : uint8_t
+{
+    None = 0,
+    // Byte-oriented LZ77 in the LZ4 style: literal runs and back-references of
+    // at least 4 bytes within a 64KB window, no entropy coding. Favours speed.
+    LZ = 1
+};
+
+// Returns false if the type is unknown. output is overwritten.
+bool compressBlock(CompressionType type, std::string_view input, std::string &output);
+
+// Returns false on malformed input or an unknown type. output is overwritten.
+bool uncompressBlock(CompressionType type, std::string_view input, std::string &output);
+
+// Counters shared by every table writer and reader of a store
+class CompressionStats
+{
+public:
+    struct Snapshot
+    {
+        uint64_t raw_bytes = 0;    // data block bytes before compression
+        uint64_t stored_bytes = 0; // data block bytes written, compressed or not
+        uint64_t blocks_compressed = 0;
+        uint64_t blocks_stored_raw = 0; // compression was tried but did not pay off
+        uint64_t compress_nanos = 0;
+        uint64_t blocks_decompressed = 0;
+        uint64_t decompress_nanos = 0;
+
+        // raw / stored; 1.0 when nothing was compressed
+        double ratio() const;
+    };
+
+    void recordCompress(size_t raw, size_t stored, bool compressed, uint64_t nanos);
+    void recordDecompress(uint64_t nanos);
+
+    Snapshot snapshot() const;
+
+private:
+    std::atomic<uint64_t> raw_bytes{0};
+    std::atomic<uint64_t> stored_bytes{0};
+    std::atomic<uint64_t> blocks_compressed{0};
+    std::atomic<uint64_t> blocks_stored_raw{0};
+    std::atomic<uint64_t> compress_nanos{0};
+    std::atomic<uint64_t> blocks_decompressed{0};
+    std::atomic<uint64_t> decompress_nanos{0};
+};
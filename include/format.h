@@ -0,0 +1,90 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <vector>
+
+// Kind of entry stored under a key, shared by the WAL, memtable and SSTables
+enum class ValueType : uint8_t
+{
+    Value = 0,
+    Deletion = 1,
+    // [key, value) is deleted; only carried by WAL records, the memtable's range
+    // list and an SSTable's range deletion block, never as a point entry
+    RangeDeletion = 2
+};
+
+// Every write takes the next number from one store-wide sequence; a read at
+// snapshot s sees exactly the writes numbered <= s. Entries written before
+// sequence numbers existed carry 0. Stored packed with the ValueType as
+// (sequence << 8) | type, hence the 56-bit limit.
+const uint64_t MAX_SEQUENCE_NUMBER = (1ull << 56) - 1;
+
+// Deletes every key in [begin, end) written before sequence. A tombstone without
+// a sequence (0) only hides older sources: within one SSTable, point entries win.
+struct RangeTombstone
+{
+    std::string begin;
+    std::string end;
+    uint64_t sequence = 0;
+
+    bool covers(std::string_view key) const { return begin <= key && key < end; }
+};
+
+// True if a tombstone visible at snapshot covers key
+bool coveredByAny(const std::vector<RangeTombstone> &tombstones, std::string_view key, uint64_t snapshot = MAX_SEQUENCE_NUMBER);
+
+// Smallest snapshot at which one of the tombstones hides the version of key written
+// at sequence (tombstones of the same source); MAX_SEQUENCE_NUMBER + 1 if none does
+uint64_t hiddenFrom(const std::vector<RangeTombstone> &tombstones, std::string_view key, uint64_t sequence);
+
+// Range deletion block: [varint32 count] then [length-prefixed begin][length-prefixed end]
+// per tombstone, followed by [varint64 sequence] when sequenced
+std::string encodeRangeTombstones(const std::vector<RangeTombstone> &tombstones);
+bool decodeRangeTombstones(std::string_view input, std::vector<RangeTombstone> &tombstones, bool sequenced = true);
+
+// Little-endian fixed-width and varint encodings shared by the on-disk formats
+
+void putFixed32(std::string &dst, uint32_t value);
+void putFixed64(std::string &dst, uint64_t value);
+void putVarint32(std::string &dst, uint32_t value);
+void putVarint64(std::string &dst, uint64_t value);
+void putLengthPrefixed(std::string &dst, std::string_view value);
+
+uint32_t decodeFixed32(const char *ptr);
+uint64_t decodeFixed64(const char *ptr);
+
+// The get* helpers consume from the front of input and return false on truncated data
+bool getFixed32(std::string_view &input, uint32_t &value);
+bool getFixed64(std::string_view &input, uint64_t &value);
+bool getVarint32(std::string_view &input, uint32_t &value);
+bool getVarint64(std::string_view &input, uint64_t &value);
+bool getLengthPrefixed(std::string_view &input, std::string_view &value);
+
+// Location of a block inside an SSTable file
+struct BlockHandle
+{
+    uint64_t offset = 0;
+    uint64_t size = 0;
+
+    void encodeTo(std::string &dst) const;
+    bool decodeFrom(std::string_view &input);
+};
+
+// Fixed-size trailer at the end of every v2+ SSTable:
+// [filter handle][properties handle][index handle] as fixed64 pairs,
+// then fixed32 format version and fixed64 magic number.
+struct Footer
+{
+    static const size_t ENCODED_LENGTH = 6 * 8 + 4 + 8;
+    static const uint64_t MAGIC = 0x4b565353543a4c53ull;
+
+    BlockHandle filter;
+    BlockHandle properties;
+    BlockHandle index;
+    uint32_t version = 0;
+
+    std::string encode() const;
+    // Returns false if the bytes do not end in the magic number (e.g. a legacy table)
+    bool decode(std::string_view input);
+};
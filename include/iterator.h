@@ -0,0 +1,145 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "memtable.h"
+
+// Bidirectional cursor over sorted key/value entries. key(), value() and type()
+// are only valid while valid() is true and until the iterator is moved.
+// Deletions are surfaced as entries so they can shadow older sources.
+class InternalIterator
+{
+public:
+    virtual ~InternalIterator() = default;
+
+    virtual bool valid() const = 0;
+    virtual void seekToFirst() = 0;
+    virtual void seekToLast() = 0;
+    // Positions at the first entry with key >= target
+    virtual void seek(std::string_view target) = 0;
+    virtual void next() = 0;
+    virtual void prev() = 0;
+
+    virtual std::string_view key() const = 0;
+    virtual std::string_view value() const = 0;
+    virtual ValueType type() const = 0;
+
+    // False once a source failed to read or a block was corrupt; entries from it
+    // were skipped
+    virtual bool ok() const { return true; }
+};
+
+class MemTableIterator : public InternalIterator
+{
+public:
+    // The caller keeps the table alive for the lifetime of the iterator
+    explicit MemTableIterator(const MemTable *table, uint64_t snapshot = MAX_SEQUENCE_NUMBER);
+
+    bool valid() const override;
+    void seekToFirst() override;
+    void seekToLast() override;
+    void seek(std::string_view target) override;
+    void next() override;
+    void prev() override;
+
+    std::string_view key() const override;
+    std::string_view value() const override;
+    ValueType type() const override;
+
+private:
+    MemTable::Iterator iter;
+};
+
+// Merges children that may hold the same key. Children are given newest
+// first; when several are positioned at one key only the newest entry is
+// surfaced and the older, shadowed versions are skipped in both directions.
+class MergingIterator : public InternalIterator
+{
+public:
+    explicit MergingIterator(std::vector<std::unique_ptr<InternalIterator>> children);
+
+    bool valid() const override;
+    void seekToFirst() override;
+    void seekToLast() override;
+    void seek(std::string_view target) override;
+    void next() override;
+    void prev() override;
+
+    std::string_view key() const override;
+    std::string_view value() const override;
+    ValueType type() const override;
+    bool ok() const override;
+
+private:
+    void findSmallest();
+    void findLargest();
+
+    std::vector<std::unique_ptr<InternalIterator>> children;
+    InternalIterator *current = nullptr;
+    bool forward = true;
+};
+
+// Concatenates the files of one sorted, non-overlapping level. Files are
+// opened lazily through open_file as the cursor reaches them.
+class LevelIterator : public InternalIterator
+{
+public:
+    using FileOpener = std::function<std::unique_ptr<InternalIterator>(size_t file)>;
+
+    // max_keys[i] is the largest key of file i
+    LevelIterator(std::vector<std::string> max_keys, FileOpener open_file);
+
+    bool valid() const override;
+    void seekToFirst() override;
+    void seekToLast() override;
+    void seek(std::string_view target) override;
+    void next() override;
+    void prev() override;
+
+    std::string_view key() const override;
+    std::string_view value() const override;
+    ValueType type() const override;
+    bool ok() const override;
+
+private:
+    void openFile(size_t file);
+    void closeFile();
+    void skipEmptyFilesForward();
+    void skipEmptyFilesBackward();
+
+    std::vector<std::string> max_keys;
+    FileOpener open_file;
+    size_t file_index;
+    std::unique_ptr<InternalIterator> file_iter;
+    // Set when a file that has since been closed was not read cleanly
+    bool corrupt = false;
+};
+
+// Hides the entries of an older source that a newer source's range tombstones
+// delete. Skips in the direction of travel, so it composes with MergingIterator.
+class RangeTombstoneFilter : public InternalIterator
+{
+public:
+    RangeTombstoneFilter(std::unique_ptr<InternalIterator> child, std::vector<RangeTombstone> tombstones);
+
+    bool valid() const override;
+    void seekToFirst() override;
+    void seekToLast() override;
+    void seek(std::string_view target) override;
+    void next() override;
+    void prev() override;
+
+    std::string_view key() const override;
+    std::string_view value() const override;
+    ValueType type() const override;
+    bool ok() const override;
+
+private:
+    void skipCoveredForward();
+    void skipCoveredBackward();
+
+    std::unique_ptr<InternalIterator> child;
+    std::vector<RangeTombstone> tombstones;
+};
@@ -3,50 +3,299 @@
 #include <optional>
 #include <memory>
 #include <shared_mutex>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <set>
+#include <map>
+#include <deque>
+#include <atomic>
 #include "memtable.h"
 #include "wal.h"
 #include "sstable.h"
 #include "bloomfilter.h"
+#include "blockcache.h"
+#include "compression.h"
+#include "tablecache.h"
+#include "iterator.h"
+#include "writebatch.h"
+#include "threadpool.h"
+#include "snapshot.h"
+#include "version.h"
+#include "manifest.h"
+#include "compaction.h"
 
-struct SSTableMetadata
+enum class CompactionStyle
 {
-    std::string filename;
-    std::vector<IndexEntry> index;
-    BloomFilter bloomFilter;
+    Leveled,  // byte-targeted levels, compacted one table at a time; least space and read amplification
+    Universal // size-tiered sorted runs merged when similar in size; least write amplification
+};
 
-    int fileId;
-    std::string minKey;
-    std::string maxKey;
-    long fileSize;
+struct KVStoreOptions
+{
+    // How the WAL makes group commits durable; see WALSyncPolicy
+    WALSyncPolicy wal_sync_policy = WALSyncPolicy::Interval;
+    int wal_sync_interval_ms = 100;
 
-    bool operator<(const SSTableMetadata &other) const
-    {
-        return filename < other.filename;
-    }
+    // Entry count at which the active memtable is sealed and handed to the flush thread
+    size_t memtable_max_entries = 64000;
+    // Arena bytes at which the memtable is sealed, whichever limit is hit first
+    size_t memtable_max_bytes = 64 * 1024 * 1024;
+
+    // Bloom filter bits per key by level; levels past the end use the last entry.
+    // More bits cost memory but lower the false-positive rate (10 bits ~ 1%).
+    std::vector<int> bloom_bits_per_key = {BloomFilter::DEFAULT_BITS_PER_KEY};
+
+    // Target size of an SSTable data block
+    size_t block_size = SSTable::DEFAULT_BLOCK_SIZE;
+    // Entries between full (restart) keys in a data block; smaller means faster
+    // in-block search, larger means better prefix compression
+    int block_restart_interval = BlockBuilder::DEFAULT_RESTART_INTERVAL;
+
+    // Data block codec by level; levels past the end use the last entry. Level 0 is
+    // rewritten soon after it is flushed, so it is left uncompressed by default.
+    std::vector<CompressionType> compression_per_level = {CompressionType::None, CompressionType::LZ};
+
+    // Check the CRC-32C of every data block read from disk. Index, filter and
+    // properties blocks are always checked when a table is opened.
+    bool verify_checksums = true;
+
+    // Bytes of data blocks kept in the shared block cache; 0 disables it
+    size_t block_cache_capacity = 8 * 1024 * 1024;
+
+    // Tables kept open and mapped by the table cache
+    size_t max_open_files = 1000;
+
+    // Chosen when the store is opened; either style reads the other's tables
+    CompactionStyle compaction_style = CompactionStyle::Leveled;
+
+    // Worker threads that run compactions; compactions on independent levels run in parallel
+    int compaction_threads = 2;
+    // Threads one compaction splits its merge across, each writing the tables for a
+    // disjoint key range; a compaction uses at most one per target_file_size of input
+    int max_subcompactions = 4;
+
+    // Level 0 is compacted into level 1 once it holds this many tables. Universal
+    // compaction merges once the store holds this many sorted runs.
+    size_t level0_compaction_trigger = 5;
+    // Target total size of level 1; each deeper level may hold max_bytes_for_level_multiplier
+    // times more. A level over its target gives up one table at a time to the next.
+    uint64_t max_bytes_for_level_base = 10 * 1024 * 1024;
+    double max_bytes_for_level_multiplier = 10;
+    // Compaction output is split into tables of about this size
+    size_t target_file_size = 2 * 1024 * 1024;
+    // The deepest level, num_levels - 1, is never compacted further
+    int num_levels = 7;
+
+    // Universal: a run joins a merge if it is at most this percent bigger than the
+    // runs already in it together
+    int universal_size_ratio = 1;
+    // Universal: fewest runs a size-ratio merge takes
+    int universal_min_merge_width = 2;
+    // Universal: every run is merged into one once the newer runs together exceed
+    // this percentage of the oldest, which bounds the space stale versions take
+    int universal_max_size_amplification_percent = 200;
+
+    // Threads that open tables (index, filter and range deletion blocks) at startup;
+    // 0 uses one per hardware thread
+    int table_loading_threads = 0;
+
+    // Threads that verify WAL checksums during recovery; 0 uses one per hardware thread
+    int wal_recovery_threads = 0;
+};
+
+// Wall time spent in each phase of opening a store
+struct StartupStats
+{
+    uint64_t manifest_micros = 0;   // MANIFEST replay, or the directory scan without one
+    uint64_t table_load_micros = 0; // opening every live table
+    uint64_t cleanup_micros = 0;    // removing orphaned tables and rewriting the MANIFEST
+    uint64_t wal_micros = 0;        // flushing a leftover rotated log and replaying the WAL
+    uint64_t total_micros = 0;
+    size_t tables_loaded = 0;
+    size_t wal_entries = 0;
+    int table_loading_threads = 0;
+};
+
+struct ReadOptions
+{
+    // Iterators only surface keys in [lower_bound, upper_bound); unset means unbounded
+    std::optional<std::string> lower_bound;
+    std::optional<std::string> upper_bound;
+    // Read the store as of this snapshot; unset reads the latest state, fixed
+    // when the read (or iterator) starts
+    const Snapshot *snapshot = nullptr;
 };
 
 class KVStore
 {
 public:
-    KVStore(const std::string &filename, const std::string &directory);
+    KVStore(const std::string &filename, const std::string &directory, const KVStoreOptions &options = KVStoreOptions());
+
+    ~KVStore();
 
     void put(const std::string &key, const std::string &value);
 
-    std::optional<std::string> get(const std::string &key) const;
+    std::optional<std::string> get(const std::string &key, const ReadOptions &read_options = ReadOptions()) const;
 
     void remove(const std::string &key);
 
+    // Deletes every key in [begin, end) with a single range tombstone; no-op if begin >= end
+    void deleteRange(const std::string &begin, const std::string &end);
+
+    // Same result as calling get() per key. Keys are sorted once, one version is read,
+    // bloom filters are probed per file in batches and each data block is read once.
+    std::vector<std::optional<std::string>> multiGet(const std::vector<std::string> &keys, const ReadOptions &read_options = ReadOptions()) const;
+
+    // Logs the batch as one WAL record, then applies it to the memtable in a single pass
+    bool write(const WriteBatch &batch);
+
+    class Iterator;
+
+    // Ordered cursor over the live keys of the whole store. Must not outlive the store.
+    std::unique_ptr<Iterator> newIterator(const ReadOptions &read_options = ReadOptions()) const;
+
+    // Pins the current state: reads given the snapshot in ReadOptions see exactly the
+    // writes made before this call, and flush and compaction keep the versions they
+    // need. Every snapshot must be released, before the store is destroyed.
+    const Snapshot *getSnapshot();
+    void releaseSnapshot(const Snapshot *snapshot);
+
+    BlockCache::Stats blockCacheStats() const;
+
+    CompressionStats::Snapshot compressionStats() const;
+
+    StartupStats startupStats() const;
+
 private:
-    std::unique_ptr<MemTable> memtable;
+    KVStoreOptions options;
+    std::shared_ptr<MemTable> memtable;
+    std::shared_ptr<MemTable> immutable_memtable;
+    mutable std::shared_mutex memtable_mutex;
     std::unique_ptr<WAL> wal;
-    std::vector<std::vector<SSTableMetadata>> levels;
     std::string data_directory;
-    mutable std::shared_mutex levels_mutex;
+    // Serializes version installs and guards the compaction scheduler state
+    std::mutex levels_mutex;
+    // File ids are unique across all levels so a file name is never reused
+    std::atomic<int> next_file_id{1};
+    // Shared by every table; entries are keyed by file id, which is never reused
+    std::unique_ptr<BlockCache> block_cache;
+    std::unique_ptr<TableCache> table_cache;
+    CompressionStats compression_stats;
+    StartupStats startup_stats;
+    // Replaced with atomic_store under levels_mutex; readers atomic_load it and
+    // need no lock. Declared after table_cache, which obsolete tables use when released.
+    std::shared_ptr<const Version> current_version;
+    std::unique_ptr<Manifest> manifest;
+
+    // Writers take sequence numbers from next_sequence and may finish out of order;
+    // visible_sequence only advances past a number once every write up to it is in
+    // the memtable, so a snapshot never includes a write still in flight.
+    std::atomic<uint64_t> next_sequence{1};
+    std::atomic<uint64_t> visible_sequence{0};
+    // Finished ranges (first -> last) waiting for an earlier write to publish
+    std::map<uint64_t, uint64_t> pending_publish;
+    std::mutex publish_mutex;
+    std::condition_variable publish_cv;
+    SnapshotList snapshots;
+
+    // Compaction scheduler state, guarded by levels_mutex. Levels the picker reports
+    // wait in compaction_queue, most urgent first, until none of the levels their
+    // compaction would touch is busy.
+    std::unique_ptr<CompactionPicker> compaction_picker;
+    std::deque<int> compaction_queue;
     std::set<int> active_compactions;
+    // Tables a compaction found unreadable; no compaction takes them again
+    std::set<int> uncompactable_files;
+    std::unique_ptr<ThreadPool> compaction_pool;
 
-    void checkCompactionStatus();
-    void compact(int level);
+    std::thread flush_thread;
+    std::mutex flush_mutex;
+    std::condition_variable flush_cv;
+    bool flush_pending = false;
+    std::atomic<bool> shutting_down{false};
+
+    bool memtableFull(const MemTable &mem) const;
+    std::shared_ptr<const Version> currentVersion() const;
+    // Logs the edit to the MANIFEST, then makes it current; false (and nothing
+    // installed) if it could not be logged. Caller holds levels_mutex.
+    bool installVersion(const VersionEdit &edit);
+    // What one read searches, pinned for its duration, and the sequence it reads at
+    struct ReadView
+    {
+        std::shared_ptr<MemTable> mem;
+        std::shared_ptr<MemTable> imm;
+        std::shared_ptr<const Version> version;
+        uint64_t sequence;
+    };
+    ReadView acquireReadView(const ReadOptions &read_options) const;
+    void publishSequence(uint64_t first, uint64_t last);
+    bool searchTable(const SSTableMetadata &sst, const std::string &key, uint64_t snapshot, std::string &value, ValueType &type, uint64_t &sequence) const;
+    // True if the table decides the key at snapshot, either with an entry or a covering range tombstone
+    bool lookupTable(const SSTableMetadata &sst, const std::string &key, uint64_t snapshot, std::optional<std::string> &result) const;
+    void searchTableMany(const SSTableMetadata &sst, const std::string_view *keys, size_t count, uint64_t snapshot, bool *found, std::string *values, ValueType *types, uint64_t *sequences) const;
+    void writeEntry(ValueType type, const std::string &key, const std::string &value);
+    static void applyEntry(MemTable &mem, ValueType type, std::string_view key, std::string_view value, uint64_t sequence);
+    int bloomBitsPerKey(int level) const;
+    TableBuilderOptions tableOptions(int level);
+    void makeRoomForWrite();
+    void flushLoop();
+    bool flushMemTable(const MemTable &mem);
+    // Keys splitting the inputs into key-range slices for parallel merging; empty
+    // if the compaction is too small to split
+    std::vector<std::string> subcompactionBoundaries(const std::vector<std::pair<TableHandle, int>> &inputs) const;
+    void maybeScheduleCompaction();
+    void dispatchCompactions();
+    void runCompaction(const Compaction &compaction);
+    // False if the compaction failed in a way a later retry may get past
+    bool compact(const Compaction &compaction);
     void loadSSTables();
+    // Streams the log at path into mem, flushing it to level 0 and starting a new
+    // one whenever it fills (flushed is then set). Returns the operations replayed.
+    // A log that is appended to afterwards is cut back past a torn tail.
+    size_t replayLog(const std::string &path, std::shared_ptr<MemTable> &mem, bool &flushed, bool truncate_torn_tail = false);
+    // Tables found in the data directory, for stores without a usable MANIFEST
+    std::vector<ManifestTable> scanTableFiles();
+    // Deletes table files that neither version nor unloaded lists
+    void removeOrphanedTables(const Version &version, const std::vector<ManifestTable> &unloaded);
     std::string generateSSTableFilename(int level, int file_id);
-};
\ No newline at end of file
+};
+
+// Merges the memtables, every L0 table and one concatenating iterator per
+// deeper level. Only the newest version of each key as of the read snapshot
+// (the latest state at creation by default) is surfaced and deleted keys are
+// skipped. The tables present at creation stay readable for the iterator's
+// lifetime, so later writes, flushes and compactions never change what it sees.
+class KVStore::Iterator
+{
+public:
+    ~Iterator();
+
+    bool valid() const;
+    void seekToFirst();
+    void seekToLast();
+    // Positions at the first key >= target
+    void seek(const std::string &target);
+    void next();
+    void prev();
+
+    std::string_view key() const;
+    std::string_view value() const;
+
+    // False once a table could not be opened or one of its blocks failed to read
+    // or its checksum; the entries in it were skipped, so the scan is incomplete
+    bool status() const;
+
+private:
+    friend class KVStore;
+    struct State;
+
+    Iterator(std::unique_ptr<State> state, const ReadOptions &read_options);
+
+    void skipDeletedForward();
+    void skipDeletedBackward();
+
+    std::unique_ptr<State> state;
+    std::unique_ptr<InternalIterator> merged;
+    ReadOptions bounds;
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "version.h"
+
+// A table as the MANIFEST records it: enough to place it in a version
+// without reading anything from the file
+struct ManifestTable
+{
+    int level;
+    int fileId;
+    // Relative to the data directory
+    std::string filename;
+    uint64_t fileSize;
+    std::string minKey;
+    std::string maxKey;
+    uint64_t largestSequence;
+    // Left out of the version by an earlier open because it could not be read
+    bool unloaded = false;
+};
+
+// Log of the version edits of a store, kept as MANIFEST in its data directory.
+// Every flush and compaction appends and syncs one record before installing the
+// new version, so after a crash the log lists exactly the tables of the last
+// installed version. Record: [fixed32 CRC-32C of payload][fixed32 payload length][payload].
+// Callers serialize create() and append() (KVStore holds levels_mutex).
+class Manifest
+{
+public:
+    static const char *const FILENAME;
+
+    explicit Manifest(const std::string &directory);
+    ~Manifest();
+
+    Manifest(const Manifest &) = delete;
+    Manifest &operator=(const Manifest &) = delete;
+
+    enum class Status
+    {
+        Ok,
+        // No MANIFEST: a new store, or one written before the log existed
+        Missing,
+        // A record other than the last one is damaged; nothing after it can be trusted
+        Corrupt
+    };
+
+    // Replays the log into the live tables and the next unused file id. A torn
+    // final record (a crash mid-append) is dropped.
+    Status recover(std::vector<ManifestTable> &tables, int &next_file_id) const;
+
+    // Replaces the log with a single record listing every table of version: written
+    // to a temporary file that is synced and renamed over MANIFEST. Later edits are
+    // appended to the new log. Tables in unloaded stay listed, marked as left out of
+    // the version.
+    bool create(const Version &version, int next_file_id, const std::vector<ManifestTable> &unloaded = {});
+
+    bool append(const VersionEdit &edit, int next_file_id);
+
+private:
+    std::string directory;
+    std::string filename;
+    int fd = -1;
+};
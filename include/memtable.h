@@ -1,29 +1,149 @@
 #pragma once
 #include <string>
-#include <map>
-#include <shared_mutex>
-#include <optional>
+#include <string_view>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include "arena.h"
+#include "format.h"
 
+// Concurrent skiplist memtable. Inserts from any number of threads link new
+// nodes with CAS and never take a lock; readers only follow acquire-loaded
+// pointers, so get() and iteration are wait-free. Nodes, keys and values are
+// bump-allocated from an Arena and released together with the table.
+//
+// Every write carries the store's sequence number. A key keeps all of its
+// versions, newest first, so reads at an older snapshot find the version they
+// see. Deletions are kept as entries of type Deletion so they shadow older
+// tables once flushed. Range tombstones are rare and live in a separate, locked
+// list; one hides exactly the versions written before it.
 class MemTable
 {
+    struct Node;
+    struct ValueNode;
+
 public:
+    static const int MAX_HEIGHT = 12;
+
     MemTable();
 
     ~MemTable();
 
-    void put(const std::string &key, const std::string &value);
+    MemTable(const MemTable &) = delete;
+    MemTable &operator=(const MemTable &) = delete;
+
+    void put(std::string_view key, std::string_view value, uint64_t sequence, ValueType type = ValueType::Value);
+
+    // True if the table decides the key as of snapshot: type is Value (value is set)
+    // or Deletion, either from a point deletion or a newer range tombstone of this table
+    bool get(std::string_view key, uint64_t snapshot, std::string &value, ValueType &type) const;
+
+    void remove(std::string_view key, uint64_t sequence);
 
-    std::optional<std::string> get(const std::string &key) const;
+    void deleteRange(std::string_view begin, std::string_view end, uint64_t sequence);
 
-    void remove(const std::string &key);
+    std::vector<RangeTombstone> rangeTombstones() const;
 
+    using VersionHandler = std::function<void(std::string_view key, std::string_view value, ValueType type, uint64_t sequence)>;
+
+    // Calls handler for every version of every key: keys ascending, versions newest
+    // first. Range tombstones are not applied.
+    void forEachVersion(const VersionHandler &handler) const;
+
+    // Point entries, deletions included
     size_t size() const;
 
+    bool empty() const;
+
+    // Bytes held by the arena backing this table
+    size_t memoryUsage() const;
+
+    // Not safe to call concurrently with any other operation
     void clear();
 
-    std::map<std::string, std::string> flush();
+    // Visits the newest version of each key as of snapshot, deletions included,
+    // but skips versions hidden by a newer range tombstone of the same table (as
+    // of the iterator's creation) and keys with no version that old
+    class Iterator
+    {
+    public:
+        explicit Iterator(const MemTable *table, uint64_t snapshot = MAX_SEQUENCE_NUMBER);
+
+        bool valid() const;
+        void seekToFirst();
+        void seekToLast();
+        void seek(std::string_view key);
+        void next();
+        // No back pointers: each step searches from the head, O(log n)
+        void prev();
+
+        std::string_view key() const;
+        std::string_view value() const;
+        ValueType type() const;
+
+    private:
+        // Points version at node's visible version; false if it has none or it is hidden
+        bool visible();
+        void skipHidden();
+        void skipHiddenBackward();
+
+        const MemTable *table;
+        uint64_t snapshot;
+        const Node *node;
+        const ValueNode *version;
+        std::vector<RangeTombstone> ranges;
+    };
 
 private:
-    std::map<std::string, std::string> table;
-    mutable std::shared_mutex rw_mutex;
-};
\ No newline at end of file
+    // Versions of a key are linked newest (highest sequence) first. Concurrent
+    // writers splice in by sequence with CAS, so the order holds even when they
+    // finish out of order; versions are freed with the arena.
+    struct ValueNode
+    {
+        const char *data;
+        uint32_t size;
+        ValueType type;
+        uint64_t sequence;
+        std::atomic<ValueNode *> prev;
+
+        std::string_view view() const { return std::string_view(data, size); }
+    };
+
+    struct Node
+    {
+        const char *key_data;
+        uint32_t key_len;
+        int height;
+        std::atomic<ValueNode *> value;
+        std::atomic<Node *> next[1];
+
+        std::string_view key() const { return std::string_view(key_data, key_len); }
+        Node *getNext(int level) const { return next[level].load(std::memory_order_acquire); }
+    };
+
+    Node *newNode(std::string_view key, int height);
+    ValueNode *newValue(std::string_view value, ValueType type, uint64_t sequence);
+    void write(std::string_view key, ValueNode *value);
+    Node *findGreaterOrEqual(std::string_view key) const;
+    // Both return nullptr instead of the head node
+    Node *findLessThan(std::string_view key) const;
+    Node *findLast() const;
+    static int randomHeight();
+    static void setValue(Node *node, ValueNode *value);
+    // Newest version with a sequence <= snapshot, or nullptr
+    static const ValueNode *versionAt(const Node *node, uint64_t snapshot);
+    static bool hiddenAt(const std::vector<RangeTombstone> &ranges, std::string_view key, uint64_t sequence, uint64_t snapshot);
+
+    std::unique_ptr<Arena> arena;
+    Node *head;
+    std::atomic<int> max_height;
+    std::atomic<size_t> num_entries;
+
+    mutable std::mutex range_mutex;
+    std::vector<RangeTombstone> range_tombstones;
+    // Lets readers skip range_mutex while the table has no range tombstones
+    std::atomic<size_t> num_range_tombstones;
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Point-in-time view of a store: reads through it see exactly the writes with
+// sequence numbers <= sequence(). Handed out by KVStore::getSnapshot and valid
+// until passed to releaseSnapshot.
+class Snapshot
+{
+public:
+    uint64_t sequence() const { return seq; }
+
+private:
+    friend class SnapshotList;
+
+    explicit Snapshot(uint64_t sequence) : seq(sequence) {}
+
+    uint64_t seq;
+};
+
+// Live snapshots of a store. Flush and compaction ask for their sequences to
+// decide which old versions a reader can still reach.
+class SnapshotList
+{
+public:
+    // Takes a snapshot of the latest visible sequence. It is read under the list's
+    // lock, so no flush or compaction can ask for the sequences in between and
+    // drop a version the snapshot sees.
+    const Snapshot *acquire(const std::atomic<uint64_t> &visible_sequence);
+
+    void release(const Snapshot *snapshot);
+
+    // Ascending, duplicates included
+    std::vector<uint64_t> sequences() const;
+
+private:
+    mutable std::mutex mutex;
+    std::list<Snapshot> snapshots;
+};
+
+// Whether a version written at sequence must be kept: some live snapshot, or a
+// current read, sees it. Snapshots from upper on see something newer (the next
+// version of the key or a covering tombstone); pass MAX_SEQUENCE_NUMBER + 1 if nothing is.
+bool versionVisible(const std::vector<uint64_t> &snapshots, uint64_t sequence, uint64_t upper);
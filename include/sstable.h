@@ -1,23 +1,174 @@
 #pragma once
 #include <string>
-#include <map>
+#include <string_view>
 #include <vector>
+#include <fstream>
+#include <cstdint>
 #include "bloomfilter.h"
+#include "memtable.h"
+#include "format.h"
+#include "block.h"
+#include "blockcache.h"
+#include "tablecache.h"
+#include "compression.h"
 
 struct IndexEntry
 {
-    std::string key;
+    std::string key; // last key in the block
     long offset;
+    long size;
+};
+
+struct TableProperties
+{
+    uint32_t format_version = 0;
+    uint64_t num_entries = 0;
+    uint64_t num_data_blocks = 0;
+    uint64_t raw_key_size = 0;
+    uint64_t raw_value_size = 0;
+    uint64_t data_size = 0;
+    // Smallest and largest key the table has anything to say about; range
+    // tombstone ends count, so max_key may be one past the last covered key
+    std::string min_key;
+    std::string max_key;
+    uint64_t num_range_deletions = 0;
+    BlockHandle range_deletions;
+    // Highest sequence number of any entry or tombstone; 0 before version 7
+    uint64_t largest_sequence = 0;
+
+    std::string encode() const;
+    bool decode(std::string_view data);
+};
+
+struct TableBuilderOptions;
+
+struct TableEntry
+{
+    std::string key;
+    std::string value;
+    ValueType type = ValueType::Value;
+    uint64_t sequence = 0;
 };
 
+// Table layout (format version 7):
+//
+//   [data block 0] ... [data block N-1] [range deletion block] [filter block] [properties block] [index block] [footer]
+//
+// Data blocks are prefix-compressed with a restart array (see block.h) and are cut
+// once they reach block_size bytes. Every block is followed by a trailer
+// [uint8 codec][fixed32 CRC-32C of the stored bytes and codec byte]; block handles
+// cover the stored bytes only. Meta blocks are never compressed. The index block maps
+// the last key of every data block to its BlockHandle. Data block entries carry
+// their ValueType and sequence number, and all versions of a key share one block;
+// the optional range deletion block holds the table's range tombstones and is
+// located through the properties block.
+//
+// Version 6 entries and tombstones have no sequence number. Version 5 entries have no type byte and deletions are "TOMBSTONE" values.
+// Version 4 data blocks carry only the codec byte and meta blocks have no trailer.
+// Version 3 tables have no block trailers and are never compressed. Version 2 tables
+// also hold plain [int key_len][key][int value_len][value] records in their blocks.
+// Legacy (version 1) tables have no footer and are nothing but records; their index is
+// rebuilt by scanning.
 class SSTable
 {
 public:
-    static std::vector<IndexEntry> flush(const std::map<std::string, std::string> &data, const std::string &filename, BloomFilter &bf);
-    
-    static std::vector<IndexEntry> flush(const std::vector<std::pair<std::string, std::string>> &data, const std::string &filename, BloomFilter &bf);
+    static const uint32_t LEGACY_FORMAT_VERSION = 1;
+    static const uint32_t FORMAT_VERSION = 7;
+    static const size_t DEFAULT_BLOCK_SIZE = 4096;
+
+    // Writes the newest version of every key and the older versions still visible to
+    // one of snapshots (ascending sequence numbers), plus the table's range tombstones.
+    // False if the table could not be fully written and synced; the caller removes
+    // whatever part of the file exists and must not refer to it.
+    static bool flush(const MemTable &memtable, const std::vector<uint64_t> &snapshots, const std::string &filename, BloomFilter &bf, const TableBuilderOptions &options, std::vector<IndexEntry> &index, TableProperties *props = nullptr);
+
+    static bool flush(const std::vector<TableEntry> &entries, const std::vector<RangeTombstone> &range_tombstones, const std::string &filename, BloomFilter &bf, const TableBuilderOptions &options, std::vector<IndexEntry> &index, TableProperties *props = nullptr);
+
+    // Opens a table: v2 tables read only the footer, index, filter and properties blocks
+    // and load the persisted filter as-is. Legacy tables have no filter, so one sized
+    // for their actual key count is built with legacy_bits_per_key while scanning.
+    // False if the file cannot be opened or its index, properties or range deletion
+    // block is unreadable, since the table's contents would then be misread.
+    static bool loadIndex(const std::string &filename, std::vector<IndexEntry> &index, BloomFilter &bf, TableProperties *props = nullptr, int legacy_bits_per_key = BloomFilter::DEFAULT_BITS_PER_KEY, std::vector<RangeTombstone> *range_tombstones = nullptr);
+
+    // The search functions report the newest version of a key with a sequence number
+    // <= snapshot, deletions included; range tombstones are kept in memory by the caller.
+    // With a cache, the data block is looked up by (file_id, block offset) before touching the file
+    static bool search(const std::string &filename, const std::vector<IndexEntry> &index, const std::string &key, std::string &value, ValueType &type, BlockCache *cache = nullptr, uint64_t file_id = 0, uint32_t format_version = FORMAT_VERSION, bool verify_checksums = true, uint64_t snapshot = MAX_SEQUENCE_NUMBER, uint64_t *sequence = nullptr);
+
+    // Reads the block straight out of the mapped file: no open, seek or copy
+    static bool search(const TableReader &table, const std::vector<IndexEntry> &index, const std::string &key, std::string &value, ValueType &type, uint64_t snapshot = MAX_SEQUENCE_NUMBER, uint64_t *sequence = nullptr);
+
+    // Looks up count ascending keys, scanning each data block once for all keys that fall in it.
+    // found[i], values[i], types[i] and sequences[i] are only written for keys present in the table.
+    static void searchMany(const TableReader &table, const std::vector<IndexEntry> &index, const std::string_view *keys, size_t count, bool *found, std::string *values, ValueType *types, uint64_t snapshot, uint64_t *sequences);
+
+    // Returns false for legacy tables, which have no footer
+    static bool readFooter(std::ifstream &file, Footer &footer);
+    static bool readFooter(std::string_view contents, Footer &footer);
+
+    static bool decodeIndex(std::string_view input, std::vector<IndexEntry> &index);
+
+    // Bytes stored after each data / meta block's handle range
+    static size_t blockTrailerSize(uint32_t format_version);
+    static size_t metaBlockTrailerSize(uint32_t format_version);
+
+    // Splits a stored block (handle bytes plus a trailer of trailer_size) into its
+    // contents, checking the CRC if asked and the trailer has one. Blocks stored raw
+    // come back as a view of stored; compressed ones are decoded into a new string
+    // returned through decoded, which contents then points into.
+    static bool decodeBlock(std::string_view stored, size_t trailer_size, bool verify_checksum, std::string_view &contents, std::shared_ptr<std::string> &decoded, CompressionStats *stats = nullptr);
+
+    // Decodes one [int key_len][key][int value_len][value] record from the front of input
+    static bool nextRecord(std::string_view &input, std::string_view &key, std::string_view &value);
+};
+
+struct TableBuilderOptions
+{
+    size_t block_size = SSTable::DEFAULT_BLOCK_SIZE;
+    int restart_interval = BlockBuilder::DEFAULT_RESTART_INTERVAL;
+    // A compressed block is only kept if it saves at least 1/8 of the raw size
+    CompressionType compression = CompressionType::None;
+    // Receives compression ratio and time when set
+    CompressionStats *stats = nullptr;
+};
+
+class SSTableWriter
+{
+public:
+    SSTableWriter(const std::string &filename, BloomFilter &bf, const TableBuilderOptions &options = TableBuilderOptions());
+
+    bool ok() const;
+
+    // Keys must be added in ascending order, versions of one key by descending sequence
+    void add(std::string_view key, std::string_view value, ValueType type = ValueType::Value, uint64_t sequence = 0);
+
+    // Any order; stored in the range deletion block
+    void addRangeTombstone(const RangeTombstone &tombstone);
+
+    // Writes the meta blocks and footer, closes the file and syncs it to disk
+    bool finish();
 
-    static std::vector<IndexEntry> loadIndex(const std::string &filename, BloomFilter &bf);
+    const std::vector<IndexEntry> &index() const;
 
-    static bool search(const std::string &filename, const std::vector<IndexEntry> &index, const std::string &key, std::string &value);
-};
\ No newline at end of file
+    const TableProperties &properties() const;
+
+private:
+    void flushBlock();
+    BlockHandle writeRaw(std::string_view data);
+    // Writes data followed by its codec and checksum trailer
+    BlockHandle writeBlock(std::string_view data, CompressionType type);
+
+    std::ofstream file;
+    std::string filename;
+    BloomFilter &bf;
+    TableBuilderOptions options;
+
+    BlockBuilder block;
+    std::string compressed;
+    std::string last_key;
+    std::vector<RangeTombstone> range_tombstones;
+    uint64_t offset = 0;
+    std::vector<IndexEntry> sparse_index;
+    TableProperties props;
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include "blockcache.h"
+#include "compression.h"
+
+// A data block ready to be parsed. data points into the mapping for blocks stored
+// raw and into owned for blocks that had to be decompressed.
+struct BlockContents
+{
+    std::string_view data;
+    BlockCache::Block owned;
+};
+
+// Shared by every reader of a store
+struct TableReaderOptions
+{
+    // Holds decompressed blocks, keyed by file id and block offset
+    BlockCache *block_cache = nullptr;
+    CompressionStats *stats = nullptr;
+    // Check each data block's CRC-32C whenever it is read from the file
+    bool verify_checksums = true;
+};
+
+// Read-only view of a whole SSTable file mapped into memory. Blocks are
+// returned as views into the mapping, so reads never copy or seek; the
+// mapping lives as long as any shared_ptr to the reader.
+class TableReader
+{
+public:
+    // Returns nullptr if the file cannot be opened or mapped. file_id keys this
+    // table's blocks in the block cache.
+    static std::shared_ptr<TableReader> open(const std::string &filename, uint64_t file_id = 0, const TableReaderOptions &options = TableReaderOptions());
+
+    ~TableReader();
+
+    TableReader(const TableReader &) = delete;
+    TableReader &operator=(const TableReader &) = delete;
+
+    std::string_view contents() const;
+
+    // Taken from the footer when the table is opened; legacy tables report version 1
+    uint32_t formatVersion() const;
+
+    // Empty view if the range lies outside the file
+    std::string_view block(uint64_t offset, uint64_t size) const;
+
+    // Data block at the handle, decompressed if needed. Scans that visit a block
+    // once (compaction) pass fill_cache = false to keep the block cache for readers.
+    bool readBlock(uint64_t offset, uint64_t size, BlockContents &out, bool fill_cache = true) const;
+
+    // Filter, properties or index block without its trailer; always verified
+    bool readMetaBlock(uint64_t offset, uint64_t size, std::string_view &out) const;
+
+private:
+    TableReader(const std::string &filename, const char *data, size_t size, uint64_t file_id, const TableReaderOptions &options);
+
+    std::string filename;
+    const char *data;
+    size_t size;
+    uint32_t format_version;
+    uint64_t file_id;
+    TableReaderOptions options;
+};
+
+// Keeps mapped readers for live tables so lookups skip the open/mmap/close
+// cycle. Bounded by max_open_files; the least recently used reader is
+// dropped first and unmapped once its last user releases it.
+class TableCache
+{
+public:
+    explicit TableCache(size_t max_open_files, const TableReaderOptions &options = TableReaderOptions());
+
+    TableCache(const TableCache &) = delete;
+    TableCache &operator=(const TableCache &) = delete;
+
+    std::shared_ptr<TableReader> get(int file_id, const std::string &filename);
+
+    // Called when a table is deleted
+    void evict(int file_id);
+
+private:
+    using Entry = std::pair<int, std::shared_ptr<TableReader>>;
+
+    size_t max_open_files;
+    TableReaderOptions options;
+    std::mutex mutex;
+    // Front is the most recently used reader
+    std::list<Entry> lru;
+    std::unordered_map<int, std::list<Entry>::iterator> readers;
+};
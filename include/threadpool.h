@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t numThreads);
+
+    // Runs every task that was already submitted, then joins the workers
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+
+    size_t size() const;
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    bool stopping = false;
+};
@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include "sstable.h"
+#include "bloomfilter.h"
+#include "tablecache.h"
+
+struct SSTableMetadata
+{
+    std::string filename;
+    std::vector<IndexEntry> index;
+    BloomFilter bloomFilter;
+
+    int fileId;
+    std::string minKey;
+    std::string maxKey;
+    long fileSize;
+    uint32_t formatVersion = SSTable::FORMAT_VERSION;
+    // Kept in memory: every lookup that reaches the table checks them
+    std::vector<RangeTombstone> rangeTombstones;
+    // Highest sequence number in the table; recorded in the MANIFEST so startup
+    // can resume numbering without reading table properties
+    uint64_t largestSequence = 0;
+
+    // Set once an installed version no longer lists the table; the file is
+    // deleted when the last version holding it is released
+    mutable std::atomic<bool> obsolete{false};
+};
+
+// Tables are shared by every version that lists them
+using TableHandle = std::shared_ptr<const SSTableMetadata>;
+
+// Takes ownership of metadata. Dropping the last handle to an obsolete table
+// evicts its reader from table_cache and deletes the file, so a reader holding
+// an older version can keep searching it.
+TableHandle newTableHandle(SSTableMetadata *metadata, TableCache *table_cache);
+
+// Tables added and removed by one flush or compaction
+struct VersionEdit
+{
+    void addFile(int level, TableHandle table);
+    void removeFile(int level, int file_id);
+
+    std::vector<std::pair<int, TableHandle>> added;
+    std::vector<std::pair<int, int>> removed;
+};
+
+// Immutable set of live tables: level 0 in file id order (oldest first),
+// deeper levels sorted by key range. Readers take a reference to the current
+// version and search it without holding any lock; flush and compaction install
+// a new version in its place.
+class Version
+{
+public:
+    Version() = default;
+    explicit Version(std::vector<std::vector<TableHandle>> levels);
+
+    size_t numLevels() const;
+
+    // Empty for levels past the deepest one
+    const std::vector<TableHandle> &files(size_t level) const;
+
+    std::shared_ptr<const Version> apply(const VersionEdit &edit) const;
+
+private:
+    void sortLevels();
+
+    std::vector<std::vector<TableHandle>> levels;
+};
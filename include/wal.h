@@ -1,13 +1,49 @@
 #pragma once
 #include <string>
-#include <fstream>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <atomic>
 #include <vector>
 #include <utility>
 #include <cstdint>
+#include <functional>
+#include <string_view>
+#include "writebatch.h"
+#include "format.h"
+
+enum class WALSyncPolicy
+{
+    EveryCommit, // fdatasync once per group commit, before any writer in the group is acknowledged
+    Interval,    // fdatasync from a background thread every sync_interval_ms
+    Never        // leave write-back to the OS page cache
+};
+
+// WALRecordHeader::version. Version 1 records are checksummed with CRC-32, later
+// ones with CRC-32C. Before version 3 a deletion was the value "TOMBSTONE".
+// From version 4 the header is followed by the record's fixed64 sequence number
+// (the first one, for a batch), which the checksum covers as well.
+const uint8_t WAL_RECORD_VERSION = 4;
+
+// WALRecordHeader::flags
+const uint8_t WAL_FLAG_BATCH = 0x1; // value holds an encoded WriteBatch, key is empty
+// Bits 1-2 hold the ValueType of a single-entry record; a range deletion's key
+// and value are its begin and end
+const int WAL_TYPE_SHIFT = 1;
+const uint8_t WAL_TYPE_MASK = 0x6;
+
+// One replayed operation; sequence is 0 for records written before version 4
+struct WALEntry
+{
+    ValueType type;
+    std::string key;
+    std::string value;
+    uint64_t sequence;
+};
 
 #pragma pack(push, 1)
-struct WALRecordHeader 
+struct WALRecordHeader
 {
     uint32_t magic;
     uint8_t version;
@@ -22,15 +58,37 @@ struct WALRecordHeader
 class WAL
 {
 public:
-    WAL(const std::string &filename);
+    WAL(const std::string &filename, WALSyncPolicy policy = WALSyncPolicy::Interval, int sync_interval_ms = 100);
 
     ~WAL();
 
-    bool write(const std::string &key, const std::string &value);
+    bool write(const std::string &key, const std::string &value, ValueType type, uint64_t sequence);
+
+    // Appends the whole batch as one record; replay yields all of its operations or
+    // none, numbered from sequence up
+    bool write(const WriteBatch &batch, uint64_t sequence);
+
+    bool sync();
+
+    // Receives one replayed operation. sequence is 0 for records written before
+    // version 4; key and value point into the mapped log and are only valid for the call.
+    using ReplayHandler = std::function<void(ValueType type, std::string_view key, std::string_view value, uint64_t sequence)>;
 
-    std::vector<std::pair<std::string, std::string>> readAll();
+    // Streams the operations of every intact record to handler in log order, batch
+    // records expanded, and returns how many there were. The log is read through a
+    // read-only mapping; checksums are verified in fixed-size chunks on up to
+    // verify_threads threads before the records are handed over. Replay stops at
+    // the first torn or corrupt record.
+    size_t replay(const ReplayHandler &handler, int verify_threads = 1);
 
-    static std::vector<std::pair<std::string, std::string>> readAllFromFile(const std::string &path);
+    // With truncate_torn_tail the file is cut back to the end of the last intact
+    // record, so records appended to it later are not stranded behind a torn one
+    static size_t replayFile(const std::string &path, const ReplayHandler &handler, int verify_threads = 1, bool truncate_torn_tail = false);
+
+    // Collects what replay() streams
+    std::vector<WALEntry> readAll();
+
+    static std::vector<WALEntry> readAllFromFile(const std::string &path);
 
     void clear();
 
@@ -39,7 +97,36 @@ public:
     void clearTemp();
 
 private:
-    std::fstream file_stream;
-    std::mutex log_mutex;
+    // A writer parked in the commit queue. The writer at the front of the queue
+    // becomes the leader and commits every queued record with one write + sync.
+    struct PendingWrite
+    {
+        const std::string *record;
+        bool done = false;
+        bool ok = false;
+        std::condition_variable cv;
+    };
+
+    static std::string encodeRecord(uint8_t flags, uint64_t sequence, std::string_view key, std::string_view value);
+
+    bool commit(const std::string &record);
+    bool appendToFile(const std::string &data);
+    void syncLoop();
+
+    int fd;
     std::string filename;
-};
\ No newline at end of file
+
+    // log_mutex guards the commit queue, file_mutex guards fd. The leader drops
+    // log_mutex while doing I/O so followers can keep queueing behind it.
+    std::mutex log_mutex;
+    std::deque<PendingWrite *> writers;
+    std::mutex file_mutex;
+
+    WALSyncPolicy sync_policy;
+    int sync_interval_ms;
+    std::atomic<bool> unsynced{false};
+    std::thread sync_thread;
+    std::mutex sync_mutex;
+    std::condition_variable sync_cv;
+    bool stop_sync = false;
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <functional>
+#include <cstdint>
+
+// Ordered collection of puts, deletes and range deletes applied by KVStore::write as one
+// unit: the whole batch is a single checksummed WAL record, so after a crash
+// either every operation in it is recovered or none is.
+//
+// Encoding: [fixed32 count] then per operation
+// [uint8 type][length-prefixed key] and, for puts and range deletes,
+// [length-prefixed value]; a range delete's key and value are its begin and end.
+class WriteBatch
+{
+public:
+    enum class OpType : uint8_t
+    {
+        Put = 1,
+        Delete = 2,
+        DeleteRange = 3
+    };
+
+    using Handler = std::function<void(OpType type, std::string_view key, std::string_view value)>;
+
+    WriteBatch();
+
+    void put(std::string_view key, std::string_view value);
+
+    void remove(std::string_view key);
+
+    // Deletes every key in [begin, end)
+    void deleteRange(std::string_view begin, std::string_view end);
+
+    void clear();
+
+    uint32_t count() const;
+
+    // Encoded operations, as stored in the WAL
+    const std::string &contents() const;
+
+    // Calls handler for every operation in order; false if rep is malformed
+    static bool iterate(std::string_view rep, const Handler &handler);
+
+private:
+    std::string rep;
+};
@@ -1,68 +1,309 @@
 #include "SSTableIterator.h"
+#include <algorithm>
 #include <iostream>
-#include <filesystem>
 
-namespace fs = std::filesystem;
+SSTableIterator::SSTableIterator(std::shared_ptr<TableReader> table, int fileId)
+    : table(std::move(table)), block_index(0), file_id(fileId), corrupt(false)
+{
+    init();
+}
 
 SSTableIterator::SSTableIterator(const std::string &filename, int fileId)
+    : table(TableReader::open(filename)), block_index(0), file_id(fileId), corrupt(false)
 {
-    file_id = fileId;
-    is_valid = false;
+    init();
+}
 
-    if (!fs::exists(filename))
+void SSTableIterator::init()
+{
+    if (!table)
     {
+        corrupt = true;
         return;
     }
 
-    file.open(filename, std::ios::binary);
+    // Tables older than version 3 hold plain records up to the meta blocks, which
+    // a single record-format block iterator can walk; legacy tables are all records
+    std::string_view contents = table->contents();
+    Footer footer;
+    bool has_footer = SSTable::readFooter(contents, footer);
 
-    if (!file.is_open())
+    if (has_footer && footer.version >= 3)
     {
-        std::cerr << "Failed to open SSTable file: " << filename << std::endl;
-        return;
+        std::string_view index_block;
+        if (!table->readMetaBlock(footer.index.offset, footer.index.size, index_block) || !SSTable::decodeIndex(index_block, blocks))
+        {
+            std::cerr << "Corrupt index block in SSTable (file id " << file_id << ")" << std::endl;
+            blocks.clear();
+            corrupt = true;
+        }
+    }
+    else
+    {
+        long data_end = has_footer ? footer.filter.offset : contents.size();
+        blocks.push_back({"", 0, data_end});
     }
 
-    next();
+    block_index = 0;
+    if (!blocks.empty())
+    {
+        openBlock(blocks[0]);
+    }
+    skipExhaustedBlocks();
 }
 
-void SSTableIterator::next()
+void SSTableIterator::openBlock(const IndexEntry &entry)
 {
-    int key_len = 0;
+    // Full scans (compaction) touch each block once, so they bypass the block cache
+    if (!table->readBlock(entry.offset, entry.size, contents, false))
+    {
+        contents = BlockContents();
+        corrupt = true;
+    }
+
+    block = std::make_unique<BlockIterator>(contents.data, table->formatVersion());
+    block->seekToFirst();
+}
 
-    if (!file.read(reinterpret_cast<char *>(&key_len), sizeof(key_len)))
+void SSTableIterator::skipExhaustedBlocks()
+{
+    while (block && !block->valid())
     {
-        is_valid = false;
-        return;
+        if (!block->ok())
+        {
+            corrupt = true;
+        }
+
+        if (++block_index >= blocks.size())
+        {
+            block.reset();
+            return;
+        }
+
+        openBlock(blocks[block_index]);
     }
+}
 
-    current_key.resize(key_len);
-    file.read(&current_key[0], key_len);
+void SSTableIterator::seek(std::string_view target)
+{
+    // Index keys are the last key of each block; a legacy table is a single block
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), target, [](const IndexEntry &entry, std::string_view key)
+                               { return entry.key < key; });
+    if (blocks.size() == 1)
+    {
+        it = blocks.begin();
+    }
 
-    int value_len = 0;
-    file.read(reinterpret_cast<char *>(&value_len), sizeof(value_len));
+    block_index = it - blocks.begin();
+    if (block_index >= blocks.size())
+    {
+        block.reset();
+        return;
+    }
 
-    current_value.resize(value_len);
-    file.read(&current_value[0], value_len);
+    openBlock(blocks[block_index]);
+    block->seek(target);
+    skipExhaustedBlocks();
+}
 
-    is_valid = true;
+void SSTableIterator::next()
+{
+    block->next();
+    skipExhaustedBlocks();
 }
 
 bool SSTableIterator::hasNext()
 {
-    return is_valid;
+    return block != nullptr;
 }
 
-std::string SSTableIterator::key() const
+std::string_view SSTableIterator::key() const
 {
-    return current_key;
+    return block->key();
 }
 
-std::string SSTableIterator::value() const
+std::string_view SSTableIterator::value() const
 {
-    return current_value;
+    return block->value();
+}
+
+ValueType SSTableIterator::type() const
+{
+    return block->type();
+}
+
+uint64_t SSTableIterator::sequence() const
+{
+    return block->sequence();
 }
 
 int SSTableIterator::getFileId() const
 {
     return file_id;
-}
\ No newline at end of file
+}
+
+bool SSTableIterator::ok() const
+{
+    return !corrupt;
+}
+
+TableIterator::TableIterator(std::shared_ptr<TableReader> table, const std::vector<IndexEntry> *index, uint64_t snapshot,
+                             const std::vector<RangeTombstone> *range_tombstones)
+    : table(std::move(table)), index(index), snapshot(snapshot), range_tombstones(range_tombstones), block_index(index->size()), position(0)
+{
+}
+
+bool TableIterator::valid() const
+{
+    return block_index < index->size() && position < entries.size();
+}
+
+void TableIterator::seekToFirst()
+{
+    loadBlock(0);
+    position = 0;
+    skipEmptyBlocksForward();
+}
+
+void TableIterator::seekToLast()
+{
+    if (index->empty())
+    {
+        loadBlock(0);
+        return;
+    }
+
+    loadBlock(index->size() - 1);
+    position = entries.empty() ? 0 : entries.size() - 1;
+    skipEmptyBlocksBackward();
+}
+
+void TableIterator::seek(std::string_view target)
+{
+    // First block whose last key is >= target, then the first entry >= target inside it
+    auto block = std::lower_bound(index->begin(), index->end(), target, [](const IndexEntry &e, std::string_view t)
+                                  { return e.key < t; });
+    loadBlock(block - index->begin());
+
+    auto entry = std::lower_bound(entries.begin(), entries.end(), target, [](const auto &e, std::string_view t)
+                                  { return e.key < t; });
+    position = entry - entries.begin();
+    skipEmptyBlocksForward();
+}
+
+void TableIterator::next()
+{
+    position++;
+    skipEmptyBlocksForward();
+}
+
+void TableIterator::prev()
+{
+    if (position == 0)
+    {
+        // Forces the backward skip into the previous block
+        entries.clear();
+    }
+    else
+    {
+        position--;
+    }
+    skipEmptyBlocksBackward();
+}
+
+std::string_view TableIterator::key() const
+{
+    return entries[position].key;
+}
+
+std::string_view TableIterator::value() const
+{
+    return entries[position].value;
+}
+
+ValueType TableIterator::type() const
+{
+    return entries[position].type;
+}
+
+bool TableIterator::ok() const
+{
+    return !corrupt;
+}
+
+void TableIterator::loadBlock(size_t block)
+{
+    block_index = block;
+    entries.clear();
+    position = 0;
+
+    if (block >= index->size())
+    {
+        return;
+    }
+
+    const IndexEntry &entry = (*index)[block];
+    if (!table->readBlock(entry.offset, entry.size, contents))
+    {
+        contents = BlockContents();
+        corrupt = true;
+        return;
+    }
+
+    BlockIterator iter(contents.data, table->formatVersion());
+    bool hide_ranges = range_tombstones && !range_tombstones->empty();
+
+    // Versions of a key are newest first; the first one old enough is the one this snapshot sees
+    std::string key;
+    bool decided = false;
+    for (iter.seekToFirst(); iter.valid(); iter.next())
+    {
+        if (decided && iter.key() == key)
+        {
+            continue;
+        }
+        decided = false;
+
+        if (iter.sequence() > snapshot)
+        {
+            continue;
+        }
+
+        key = iter.key();
+        decided = true;
+
+        if (hide_ranges && hiddenFrom(*range_tombstones, key, iter.sequence()) <= snapshot)
+        {
+            continue;
+        }
+        entries.push_back({key, iter.value(), iter.type()});
+    }
+
+    if (!iter.ok())
+    {
+        corrupt = true;
+    }
+}
+
+void TableIterator::skipEmptyBlocksForward()
+{
+    while (block_index < index->size() && position >= entries.size())
+    {
+        loadBlock(block_index + 1);
+    }
+}
+
+void TableIterator::skipEmptyBlocksBackward()
+{
+    while (block_index < index->size() && position >= entries.size())
+    {
+        if (block_index == 0)
+        {
+            loadBlock(index->size());
+            return;
+        }
+
+        loadBlock(block_index - 1);
+        position = entries.empty() ? 0 : entries.size() - 1;
+    }
+}
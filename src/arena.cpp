@@ -0,0 +1,65 @@
+#include "arena.h"
+#include <new>
+
+Arena::Arena() : memory_usage(0)
+{
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    current.store(newBlock(BLOCK_SIZE), std::memory_order_relaxed);
+}
+
+Arena::~Arena()
+{
+    for (Block *block : blocks)
+    {
+        ::operator delete(block);
+    }
+}
+
+Arena::Block *Arena::newBlock(size_t capacity)
+{
+    // Caller holds blocks_mutex. The header and the payload share one heap allocation.
+    size_t header = (sizeof(Block) + 7) & ~static_cast<size_t>(7);
+    char *mem = static_cast<char *>(::operator new(header + capacity));
+
+    Block *block = new (mem) Block{capacity, {0}, mem + header};
+    blocks.push_back(block);
+    memory_usage.fetch_add(header + capacity, std::memory_order_relaxed);
+
+    return block;
+}
+
+char *Arena::allocate(size_t bytes)
+{
+    bytes = (bytes + 7) & ~static_cast<size_t>(7);
+
+    // Large objects get a block of their own so they don't waste the tail of the current one
+    if (bytes > BLOCK_SIZE / 4)
+    {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        Block *block = newBlock(bytes);
+        block->used.store(bytes, std::memory_order_relaxed);
+        return block->data;
+    }
+
+    while (true)
+    {
+        Block *block = current.load(std::memory_order_acquire);
+        size_t offset = block->used.fetch_add(bytes, std::memory_order_relaxed);
+
+        if (offset + bytes <= block->capacity)
+        {
+            return block->data + offset;
+        }
+
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        if (current.load(std::memory_order_relaxed) == block)
+        {
+            current.store(newBlock(BLOCK_SIZE), std::memory_order_release);
+        }
+    }
+}
+
+size_t Arena::memoryUsage() const
+{
+    return memory_usage.load(std::memory_order_relaxed);
+}
@@ -11,6 +11,7 @@
 #include <mutex>
 #include <filesystem>
 #include "kvstore.h"
+#include "checksum.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -153,6 +154,76 @@ public:
         Stats::print("Hot/Cold Read (80/20)", Stats::calculate(latencies, duration_seconds));
     }
 
+    void runMultiGet(KVStore& store, int batchSize) {
+        vector<double> latencies;
+        latencies.reserve(NUM_KEYS / batchSize);
+
+        mt19937 gen(42);
+        uniform_int_distribution<> dis(0, NUM_KEYS - 1);
+
+        auto start = high_resolution_clock::now();
+        for (int i = 0; i < NUM_KEYS; i += batchSize) {
+            vector<string> keys;
+            keys.reserve(batchSize);
+            for (int j = 0; j < batchSize; j++) {
+                keys.push_back(KeyGenerator::getSequential(dis(gen)));
+            }
+
+            auto t1 = high_resolution_clock::now();
+            store.multiGet(keys);
+            auto t2 = high_resolution_clock::now();
+            latencies.push_back(duration<double, micro>(t2 - t1).count());
+        }
+        auto end = high_resolution_clock::now();
+
+        // Throughput in keys/sec; latencies are per batch
+        double duration_seconds = duration<double>(end - start).count();
+        BenchmarkResult res = Stats::calculate(latencies, duration_seconds);
+        res.throughputOps = NUM_KEYS / duration_seconds;
+        Stats::print("MultiGet (" + to_string(batchSize) + " keys)", res);
+    }
+
+    void printBlockCacheStats(KVStore& store) {
+        BlockCache::Stats stats = store.blockCacheStats();
+        uint64_t lookups = stats.hits + stats.misses;
+        double hitRate = lookups ? 100.0 * stats.hits / lookups : 0.0;
+
+        cout << left << setw(25) << "Block Cache"
+             << " | Hits: " << stats.hits << " | Misses: " << stats.misses
+             << " | Hit rate: " << fixed << setprecision(1) << hitRate << "%"
+             << " | Usage: " << stats.usage / 1024 << "KB" << endl;
+    }
+
+    void printCompressionStats(KVStore& store) {
+        CompressionStats::Snapshot stats = store.compressionStats();
+        double compressMBs = stats.compress_nanos ? stats.raw_bytes * 1e3 / stats.compress_nanos : 0.0;
+
+        cout << left << setw(25) << "Compression"
+             << " | Ratio: " << fixed << setprecision(2) << stats.ratio()
+             << " | Blocks: " << stats.blocks_compressed << " compressed, " << stats.blocks_stored_raw << " raw"
+             << " | Compress: " << setprecision(1) << compressMBs << " MB/s"
+             << " | Decompressed: " << stats.blocks_decompressed << " blocks";
+        if (stats.blocks_decompressed) {
+            cout << " (" << setprecision(2) << stats.decompress_nanos / 1e3 / stats.blocks_decompressed << " us/block)";
+        }
+        cout << endl;
+    }
+
+    // Reopens the store left by the earlier phases; 0 threads loads tables on every core
+    void runReopen(int loadingThreads) {
+        KVStoreOptions options;
+        options.table_loading_threads = loadingThreads;
+        KVStore store(dataDir + "/wal.log", dataDir, options);
+        StartupStats stats = store.startupStats();
+
+        cout << left << setw(25) << ("Reopen (" + to_string(stats.table_loading_threads) + " threads)")
+             << " | Total: " << fixed << setprecision(2) << stats.total_micros / 1e3 << " ms"
+             << " | MANIFEST: " << stats.manifest_micros / 1e3
+             << " | Tables: " << stats.table_load_micros / 1e3 << " (" << stats.tables_loaded << ")"
+             << " | Cleanup: " << stats.cleanup_micros / 1e3
+             << " | WAL: " << stats.wal_micros / 1e3 << endl;
+    }
+
     void runConcurrentMixed(KVStore& store, int numThreads) {
         atomic<bool> startFlag{false};
         vector<thread> threads;
@@ -203,10 +274,78 @@ public:
         Stats::print(title, Stats::calculate(allLatencies, duration_seconds));
     }
 
+    void runConcurrentWrite(KVStore& store, int numThreads) {
+        atomic<bool> startFlag{false};
+        vector<thread> threads;
+        vector<vector<double>> threadLatencies(numThreads);
+
+        int opsPerThread = NUM_KEYS / numThreads;
+        string val = randomString(VALUE_SIZE);
+
+        for (int t = 0; t < numThreads; t++) {
+            threads.emplace_back([&, t]() {
+                while (!startFlag);
+
+                for (int i = 0; i < opsPerThread; i++) {
+                    string key = KeyGenerator::getSequential(t * opsPerThread + i);
+
+                    auto t1 = high_resolution_clock::now();
+                    store.put(key, val);
+                    auto t2 = high_resolution_clock::now();
+                    threadLatencies[t].push_back(duration<double, micro>(t2 - t1).count());
+                }
+            });
+        }
+
+        auto start = high_resolution_clock::now();
+        startFlag = true;
+
+        for (auto& t : threads) t.join();
+
+        auto end = high_resolution_clock::now();
+
+        vector<double> allLatencies;
+        for (const auto& v : threadLatencies) {
+            allLatencies.insert(allLatencies.end(), v.begin(), v.end());
+        }
+
+        double duration_seconds = duration<double>(end - start).count();
+        string title = "Concurrent Write (" + to_string(numThreads) + "t)";
+        Stats::print(title, Stats::calculate(allLatencies, duration_seconds));
+    }
+
+    void runBatchWrite(KVStore& store, int batchSize) {
+        vector<double> latencies;
+        latencies.reserve(NUM_KEYS / batchSize);
+
+        string val = randomString(VALUE_SIZE);
+
+        auto start = high_resolution_clock::now();
+        for (int i = 0; i < NUM_KEYS; i += batchSize) {
+            WriteBatch batch;
+            for (int j = i; j < i + batchSize && j < NUM_KEYS; j++) {
+                batch.put(KeyGenerator::getSequential(j), val);
+            }
+
+            auto t1 = high_resolution_clock::now();
+            store.write(batch);
+            auto t2 = high_resolution_clock::now();
+            latencies.push_back(duration<double, micro>(t2 - t1).count());
+        }
+        auto end = high_resolution_clock::now();
+
+        // Throughput in keys/sec; latencies are per batch
+        double duration_seconds = duration<double>(end - start).count();
+        BenchmarkResult res = Stats::calculate(latencies, duration_seconds);
+        res.throughputOps = NUM_KEYS / duration_seconds;
+        Stats::print("Batch Write (" + to_string(batchSize) + "/batch)", res);
+    }
+
     void runAll() {
         cout << "================================================================================" << endl;
         cout << "  ADVANCED KEY-VALUE STORE BENCHMARK" << endl;
-        cout << "  (Keys: " << NUM_KEYS << ", ValSize: " << VALUE_SIZE << "B)" << endl;
+        cout << "  (Keys: " << NUM_KEYS << ", ValSize: " << VALUE_SIZE << "B, CRC32C: "
+             << (crc32c_hardware() ? "SSE4.2" : "slicing-by-8") << ")" << endl;
         cout << "================================================================================" << endl;
 
         resetEnvironment();
@@ -220,12 +359,23 @@ public:
             cout << "\n--- Phase 2: Read Patterns ---" << endl;
             runRandomRead(store);
             runHotRead(store);
+            runMultiGet(store, 100);
+            printBlockCacheStats(store);
 
             cout << "\n--- Phase 3: Concurrency & Contention ---" << endl;
             runConcurrentMixed(store, 4);
             runConcurrentMixed(store, 8);
+            runConcurrentWrite(store, 1);
+            runConcurrentWrite(store, 4);
+            runConcurrentWrite(store, 8);
+            runBatchWrite(store, 100);
+            printCompressionStats(store);
         }
 
+        cout << "\n--- Phase 4: Recovery ---" << endl;
+        runReopen(1);
+        runReopen(0);
+
         cout << "================================================================================" << endl;
     }
 };
@@ -0,0 +1,273 @@
+#include "block.h"
+#include "format.h"
+#include "sstable.h"
+#include <algorithm>
+
+BlockBuilder::BlockBuilder(int restart_interval)
+    : restart_interval(std::max(restart_interval, 1)), counter(0)
+{
+    restarts.push_back(0);
+}
+
+void BlockBuilder::add(std::string_view key, std::string_view value, ValueType type, uint64_t sequence)
+{
+    size_t shared = 0;
+
+    if (counter < restart_interval)
+    {
+        size_t limit = std::min(last_key.size(), key.size());
+        while (shared < limit && last_key[shared] == key[shared])
+        {
+            shared++;
+        }
+    }
+    else
+    {
+        restarts.push_back(buffer.size());
+        counter = 0;
+    }
+
+    size_t non_shared = key.size() - shared;
+
+    putVarint32(buffer, shared);
+    putVarint32(buffer, non_shared);
+    putVarint32(buffer, value.size());
+    buffer.append(key.data() + shared, non_shared);
+    putVarint64(buffer, (sequence << 8) | static_cast<uint8_t>(type));
+    buffer.append(value.data(), value.size());
+
+    last_key.resize(shared);
+    last_key.append(key.data() + shared, non_shared);
+    counter++;
+}
+
+std::string_view BlockBuilder::finish()
+{
+    for (uint32_t restart : restarts)
+    {
+        putFixed32(buffer, restart);
+    }
+    putFixed32(buffer, restarts.size());
+    return buffer;
+}
+
+void BlockBuilder::reset()
+{
+    buffer.clear();
+    restarts.assign(1, 0);
+    counter = 0;
+    last_key.clear();
+}
+
+bool BlockBuilder::empty() const
+{
+    return buffer.empty();
+}
+
+size_t BlockBuilder::sizeEstimate() const
+{
+    return buffer.size() + restarts.size() * sizeof(uint32_t) + sizeof(uint32_t);
+}
+
+BlockIterator::BlockIterator(std::string_view contents, uint32_t format_version)
+    : data(contents), prefix_encoded(format_version >= 3), typed(format_version >= 6), sequenced(format_version >= 7),
+      restarts_offset(0), num_restarts(0), next_offset(0), current_type(ValueType::Value), current_sequence(0), is_valid(false), corrupt(false)
+{
+    if (!prefix_encoded)
+    {
+        restarts_offset = data.size();
+        return;
+    }
+
+    if (data.size() < sizeof(uint32_t))
+    {
+        corrupt = true;
+        return;
+    }
+
+    num_restarts = decodeFixed32(data.data() + data.size() - sizeof(uint32_t));
+    size_t trailer = (static_cast<size_t>(num_restarts) + 1) * sizeof(uint32_t);
+
+    if (num_restarts == 0 || trailer > data.size())
+    {
+        corrupt = true;
+        num_restarts = 0;
+        return;
+    }
+
+    restarts_offset = data.size() - trailer;
+}
+
+bool BlockIterator::valid() const
+{
+    return is_valid;
+}
+
+bool BlockIterator::ok() const
+{
+    return !corrupt;
+}
+
+void BlockIterator::seekToFirst()
+{
+    if (corrupt)
+    {
+        is_valid = false;
+        return;
+    }
+
+    next_offset = 0;
+    current_key.clear();
+    next();
+}
+
+void BlockIterator::seek(std::string_view target)
+{
+    if (corrupt)
+    {
+        is_valid = false;
+        return;
+    }
+
+    if (prefix_encoded)
+    {
+        // Last restart whose key is < target; restart entries store their full key
+        uint32_t left = 0;
+        uint32_t right = num_restarts - 1;
+
+        while (left < right)
+        {
+            uint32_t mid = (left + right + 1) / 2;
+            seekToRestart(mid);
+
+            if (!is_valid || current_key_view >= target)
+            {
+                right = mid - 1;
+            }
+            else
+            {
+                left = mid;
+            }
+        }
+
+        seekToRestart(left);
+    }
+    else
+    {
+        seekToFirst();
+    }
+
+    while (is_valid && current_key_view < target)
+    {
+        next();
+    }
+}
+
+void BlockIterator::next()
+{
+    is_valid = parseNext();
+}
+
+std::string_view BlockIterator::key() const
+{
+    return current_key_view;
+}
+
+std::string_view BlockIterator::value() const
+{
+    return current_value;
+}
+
+ValueType BlockIterator::type() const
+{
+    return current_type;
+}
+
+uint64_t BlockIterator::sequence() const
+{
+    return current_sequence;
+}
+
+uint32_t BlockIterator::restartOffset(uint32_t index) const
+{
+    return decodeFixed32(data.data() + restarts_offset + index * sizeof(uint32_t));
+}
+
+void BlockIterator::seekToRestart(uint32_t index)
+{
+    next_offset = restartOffset(index);
+    current_key.clear();
+    next();
+}
+
+bool BlockIterator::parseNext()
+{
+    if (next_offset >= restarts_offset)
+    {
+        return false;
+    }
+
+    std::string_view input = data.substr(next_offset, restarts_offset - next_offset);
+
+    if (!prefix_encoded)
+    {
+        if (!SSTable::nextRecord(input, current_key_view, current_value))
+        {
+            return false;
+        }
+        next_offset = restarts_offset - input.size();
+        current_type = current_value == "TOMBSTONE" ? ValueType::Deletion : ValueType::Value;
+        return true;
+    }
+
+    uint32_t shared, non_shared, value_len;
+    if (!getVarint32(input, shared) || !getVarint32(input, non_shared) || !getVarint32(input, value_len) ||
+        shared > current_key.size() || input.size() < non_shared)
+    {
+        corrupt = true;
+        return false;
+    }
+
+    current_key.resize(shared);
+    current_key.append(input.data(), non_shared);
+    current_key_view = current_key;
+    input.remove_prefix(non_shared);
+
+    // Version 6 stores the type alone in one byte, which reads as a tag with sequence 0
+    uint64_t tag = 0;
+    bool tag_ok = true;
+    if (sequenced)
+    {
+        tag_ok = getVarint64(input, tag);
+    }
+    else if (typed)
+    {
+        tag_ok = !input.empty();
+        if (tag_ok)
+        {
+            tag = static_cast<uint8_t>(input.front());
+            input.remove_prefix(1);
+        }
+    }
+
+    if (!tag_ok || input.size() < value_len)
+    {
+        corrupt = true;
+        return false;
+    }
+
+    current_value = input.substr(0, value_len);
+    current_sequence = tag >> 8;
+
+    if (typed)
+    {
+        current_type = static_cast<ValueType>(tag & 0xff);
+    }
+    else
+    {
+        current_type = current_value == "TOMBSTONE" ? ValueType::Deletion : ValueType::Value;
+    }
+
+    next_offset = restarts_offset - input.size() + value_len;
+    return true;
+}
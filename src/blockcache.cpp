@@ -0,0 +1,101 @@
+#include "blockcache.h"
+#include <algorithm>
+
+namespace
+{
+inline uint64_t mixKey(uint64_t file_id, uint64_t offset)
+{
+    uint64_t h = file_id * 0x9e3779b97f4a7c15ull ^ offset;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+}
+
+size_t BlockCache::KeyHash::operator()(const std::pair<uint64_t, uint64_t> &key) const
+{
+    return mixKey(key.first, key.second);
+}
+
+BlockCache::BlockCache(size_t capacity, int numShards) : capacity(capacity)
+{
+    numShards = std::max(numShards, 1);
+
+    for (int i = 0; i < numShards; i++)
+    {
+        shards.push_back(std::make_unique<Shard>());
+        shards.back()->capacity = (capacity + numShards - 1) / numShards;
+    }
+}
+
+BlockCache::Shard &BlockCache::shardFor(uint64_t file_id, uint64_t offset)
+{
+    // Top bits pick the shard; the per-shard hash map uses the low bits
+    return *shards[(mixKey(file_id, offset) >> 32) % shards.size()];
+}
+
+BlockCache::Block BlockCache::lookup(uint64_t file_id, uint64_t offset)
+{
+    Shard &shard = shardFor(file_id, offset);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.map.find({file_id, offset});
+    if (it == shard.map.end())
+    {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return it->second->block;
+}
+
+void BlockCache::insert(uint64_t file_id, uint64_t offset, Block block)
+{
+    size_t charge = block->size();
+    Shard &shard = shardFor(file_id, offset);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if (charge > shard.capacity)
+    {
+        return;
+    }
+
+    auto existing = shard.map.find({file_id, offset});
+    if (existing != shard.map.end())
+    {
+        shard.usage -= existing->second->block->size();
+        shard.lru.erase(existing->second);
+        shard.map.erase(existing);
+    }
+
+    while (!shard.lru.empty() && shard.usage + charge > shard.capacity)
+    {
+        const Entry &victim = shard.lru.back();
+        shard.usage -= victim.block->size();
+        shard.map.erase({victim.file_id, victim.offset});
+        shard.lru.pop_back();
+    }
+
+    shard.lru.push_front({file_id, offset, std::move(block)});
+    shard.map[{file_id, offset}] = shard.lru.begin();
+    shard.usage += charge;
+}
+
+BlockCache::Stats BlockCache::stats() const
+{
+    Stats result;
+    result.hits = hits.load(std::memory_order_relaxed);
+    result.misses = misses.load(std::memory_order_relaxed);
+    result.capacity = capacity;
+
+    for (const auto &shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        result.usage += shard->usage;
+    }
+
+    return result;
+}
@@ -1,7 +1,33 @@
 #include "bloomfilter.h"
-#include <functional>
+#include "format.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
 
-BloomFilter::BloomFilter(size_t numKeys, int k) : k(k)
+namespace
+{
+const uint32_t BLOCKED_FILTER_TAG = 0x424c4f4b; // "BLOK"
+const size_t PREFETCH_BATCH = 32;
+
+inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+}
+
+BloomFilter::BloomFilter() : k(0) {}
+
+BloomFilter::BloomFilter(size_t numKeys, int bitsPerKey)
 {
 
     if (numKeys <= 0)
@@ -9,46 +35,176 @@ BloomFilter::BloomFilter(size_t numKeys, int k) : k(k)
         throw std::invalid_argument("numKeys must be greater than 0");
     }
 
-    bits.resize(numKeys * 10);
+    if (bitsPerKey < 1)
+    {
+        bitsPerKey = 1;
+    }
+
+    // k = ln(2) * bits per key, clamped to keep probing cost bounded
+    k = std::clamp(static_cast<int>(bitsPerKey * 0.69), 1, 30);
+
+    size_t total_bits = numKeys * bitsPerKey;
+    blocks.assign(std::max<size_t>((total_bits + 511) / 512, 1), CacheLine{});
 }
 
-std::vector<size_t> BloomFilter::getHashIndices(const std::string &key) const
+uint64_t BloomFilter::hash(std::string_view key)
 {
-    std::vector<size_t> indices;
+    // 8 bytes per round, in the style of xxHash64/wyhash; strong enough for a bloom filter
+    const uint64_t prime1 = 0x9e3779b185ebca87ull;
+    const uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
 
-    size_t hash1 = std::hash<std::string>()(key);
-    size_t hash2 = hash1 * 0x9e3779b9;
+    const char *p = key.data();
+    size_t len = key.size();
+    uint64_t h = prime1 ^ (len * prime2);
 
-    for (int i = 0; i < k; i++)
+    while (len >= 8)
     {
-        size_t index = (hash1 + i * hash2) % bits.size();
-        indices.push_back(index);
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        h = rotl(h ^ (v * prime2), 31) * prime1;
+        p += 8;
+        len -= 8;
     }
 
-    return indices;
+    uint64_t tail = 0;
+    std::memcpy(&tail, p, len);
+    h = rotl(h ^ (tail * prime2), 27) * prime1;
+
+    return mix(h);
 }
 
-void BloomFilter::add(const std::string &key)
+const BloomFilter::CacheLine &BloomFilter::blockFor(uint64_t h) const
 {
-    std::vector<size_t> indices = getHashIndices(key);
+    // Upper 32 bits pick the block (multiply-shift instead of modulo)
+    return blocks[((h >> 32) * blocks.size()) >> 32];
+}
 
-    for (size_t index : indices)
+void BloomFilter::add(std::string_view key)
+{
+    if (blocks.empty())
     {
-        bits[index] = true;
+        return;
+    }
+
+    uint64_t h = hash(key);
+    uint64_t *block = const_cast<CacheLine &>(blockFor(h)).words;
+
+    // Lower 32 bits drive the probes: each multiply by the golden ratio yields the next 9-bit offset
+    uint32_t probe = static_cast<uint32_t>(h);
+    for (int i = 0; i < k; i++)
+    {
+        uint32_t bit = probe >> (32 - 9);
+        block[bit >> 6] |= uint64_t(1) << (bit & 63);
+        probe *= 0x9e3779b9u;
     }
 }
 
-bool BloomFilter::contains(const std::string &key) const
+bool BloomFilter::contains(std::string_view key) const
 {
-    std::vector<size_t> indices = getHashIndices(key);
+    if (blocks.empty())
+    {
+        return true;
+    }
 
-    for (size_t index : indices)
+    uint64_t h = hash(key);
+    const uint64_t *block = blockFor(h).words;
+
+    uint32_t probe = static_cast<uint32_t>(h);
+    for (int i = 0; i < k; i++)
     {
-        if (!bits[index])
+        uint32_t bit = probe >> (32 - 9);
+        if ((block[bit >> 6] & (uint64_t(1) << (bit & 63))) == 0)
         {
             return false;
         }
+        probe *= 0x9e3779b9u;
     }
 
     return true;
 }
+
+void BloomFilter::containsMany(const std::string_view *keys, size_t count, bool *results) const
+{
+    if (blocks.empty())
+    {
+        std::fill(results, results + count, true);
+        return;
+    }
+
+    uint64_t hashes[PREFETCH_BATCH];
+
+    for (size_t start = 0; start < count; start += PREFETCH_BATCH)
+    {
+        size_t batch = std::min(PREFETCH_BATCH, count - start);
+
+        for (size_t i = 0; i < batch; i++)
+        {
+            hashes[i] = hash(keys[start + i]);
+#if defined(__GNUC__) || defined(__clang__)
+            __builtin_prefetch(&blockFor(hashes[i]));
+#endif
+        }
+
+        for (size_t i = 0; i < batch; i++)
+        {
+            const uint64_t *block = blockFor(hashes[i]).words;
+            uint32_t probe = static_cast<uint32_t>(hashes[i]);
+            bool match = true;
+
+            for (int j = 0; j < k && match; j++)
+            {
+                uint32_t bit = probe >> (32 - 9);
+                match = (block[bit >> 6] & (uint64_t(1) << (bit & 63))) != 0;
+                probe *= 0x9e3779b9u;
+            }
+
+            results[start + i] = match;
+        }
+    }
+}
+
+std::string BloomFilter::encode() const
+{
+    std::string data;
+    putFixed32(data, BLOCKED_FILTER_TAG);
+    putFixed32(data, k);
+    putFixed32(data, blocks.size());
+
+    for (const auto &block : blocks)
+    {
+        for (uint64_t word : block.words)
+        {
+            putFixed64(data, word);
+        }
+    }
+
+    return data;
+}
+
+bool BloomFilter::decode(std::string_view data, BloomFilter &out)
+{
+    uint32_t tag, k, num_blocks;
+    if (!getFixed32(data, tag) || tag != BLOCKED_FILTER_TAG || !getFixed32(data, k) || !getFixed32(data, num_blocks) ||
+        data.size() < static_cast<size_t>(num_blocks) * sizeof(CacheLine))
+    {
+        return false;
+    }
+
+    out.k = k;
+    out.blocks.assign(num_blocks, CacheLine{});
+
+    for (auto &block : out.blocks)
+    {
+        for (uint64_t &word : block.words)
+        {
+            getFixed64(data, word);
+        }
+    }
+
+    return true;
+}
+
+size_t BloomFilter::numBits() const
+{
+    return blocks.size() * 512;
+}
@@ -1,25 +1,108 @@
 #include "checksum.h"
 
 #include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
 
 namespace {
 constexpr uint32_t poly = 0xEDB88320u;
+constexpr uint32_t poly_c = 0x82F63B78u;
 
-constexpr std::array<uint32_t, 256> make_table()
+constexpr std::array<uint32_t, 256> make_table(uint32_t p)
 {
     std::array<uint32_t, 256> table{};
 
     for (uint32_t i = 0; i < 256; ++i) {
         uint32_t c = i;
         for (int j = 0; j < 8; ++j) {
-            c = (c & 1u) ? (poly ^ (c >> 1)) : (c >> 1);
+            c = (c & 1u) ? (p ^ (c >> 1)) : (c >> 1);
         }
         table[i] = c;
     }
     return table;
 }
 
-constexpr std::array<uint32_t, 256> crc32_table = make_table();
+// tables[k][b] is the CRC of byte b followed by k zero bytes, so eight input
+// bytes fold into the CRC with eight independent lookups
+constexpr std::array<std::array<uint32_t, 256>, 8> make_slicing_tables(uint32_t p)
+{
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    tables[0] = make_table(p);
+
+    for (int k = 1; k < 8; ++k) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = tables[k - 1][i];
+            tables[k][i] = (c >> 8) ^ tables[0][c & 0xFFu];
+        }
+    }
+    return tables;
+}
+
+constexpr std::array<uint32_t, 256> crc32_table = make_table(poly);
+constexpr std::array<std::array<uint32_t, 256>, 8> crc32c_tables = make_slicing_tables(poly_c);
+
+// Little-endian load; every target this builds for is little-endian
+inline uint32_t load32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t crc32c_portable(uint32_t c, const uint8_t* data, size_t len) {
+    const auto& t = crc32c_tables;
+
+    while (len >= 8) {
+        uint32_t lo = c ^ load32(data);
+        uint32_t hi = load32(data + 4);
+        c = t[7][lo & 0xFFu] ^ t[6][(lo >> 8) & 0xFFu] ^ t[5][(lo >> 16) & 0xFFu] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xFFu] ^ t[2][(hi >> 8) & 0xFFu] ^ t[1][(hi >> 16) & 0xFFu] ^ t[0][hi >> 24];
+        data += 8;
+        len -= 8;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        c = t[0][(c ^ data[i]) & 0xFFu] ^ (c >> 8);
+    }
+    return c;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t c, const uint8_t* data, size_t len) {
+    uint64_t c64 = c;
+
+    while (len >= 8) {
+        uint64_t v;
+        std::memcpy(&v, data, sizeof(v));
+        c64 = _mm_crc32_u64(c64, v);
+        data += 8;
+        len -= 8;
+    }
+
+    c = static_cast<uint32_t>(c64);
+    for (size_t i = 0; i < len; ++i) {
+        c = _mm_crc32_u8(c, data[i]);
+    }
+    return c;
+}
+#endif
+
+using crc32c_fn = uint32_t (*)(uint32_t, const uint8_t*, size_t);
+
+crc32c_fn select_crc32c() {
+#ifdef CRC32C_HAVE_SSE42
+    if (__builtin_cpu_supports("sse4.2")) {
+        return crc32c_sse42;
+    }
+#endif
+    return crc32c_portable;
+}
+
+const crc32c_fn crc32c_impl = select_crc32c();
 }
 
 uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t len) {
@@ -36,4 +119,24 @@ uint32_t crc32(const uint8_t* data, size_t len) {
 
 uint32_t crc32(const std::string& s) {
     return crc32(reinterpret_cast<const uint8_t*>(s.data()), s.size());
-}
\ No newline at end of file
+}
+
+uint32_t crc32c_update(uint32_t crc, const uint8_t* data, size_t len) {
+    return crc32c_impl(crc ^ 0xFFFFFFFFu, data, len) ^ 0xFFFFFFFFu;
+}
+
+uint32_t crc32c(const uint8_t* data, size_t len) {
+    return crc32c_update(0u, data, len);
+}
+
+uint32_t crc32c(std::string_view s) {
+    return crc32c(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+}
+
+bool crc32c_hardware() {
+#ifdef CRC32C_HAVE_SSE42
+    return crc32c_impl == crc32c_sse42;
+#else
+    return false;
+#endif
+}
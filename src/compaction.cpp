@@ -0,0 +1,275 @@
+#include "compaction.h"
+#include "kvstore.h"
+#include <algorithm>
+
+namespace
+{
+uint64_t totalBytes(const std::vector<TableHandle> &tables)
+{
+    uint64_t bytes = 0;
+    for (const auto &sst : tables)
+    {
+        bytes += sst->fileSize;
+    }
+    return bytes;
+}
+
+bool emptyBelow(const Version &version, int level)
+{
+    for (size_t i = level + 1; i < version.numLevels(); ++i)
+    {
+        if (!version.files(i).empty())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+LeveledCompactionPicker::LeveledCompactionPicker(const KVStoreOptions &options)
+    : options(options)
+{
+}
+
+uint64_t LeveledCompactionPicker::maxBytesForLevel(int level) const
+{
+    double bytes = options.max_bytes_for_level_base;
+    for (int i = 1; i < level; ++i)
+    {
+        bytes *= options.max_bytes_for_level_multiplier;
+    }
+    return static_cast<uint64_t>(bytes);
+}
+
+double LeveledCompactionPicker::score(const Version &version, int level) const
+{
+    const auto &files = version.files(level);
+    if (level == 0)
+    {
+        return static_cast<double>(files.size()) / std::max<size_t>(options.level0_compaction_trigger, 1);
+    }
+
+    return static_cast<double>(totalBytes(files)) / std::max<uint64_t>(maxBytesForLevel(level), 1);
+}
+
+std::vector<int> LeveledCompactionPicker::levelsToCompact(const Version &version) const
+{
+    std::vector<std::pair<double, int>> scores;
+    for (int level = 0; level + 1 < options.num_levels && level < static_cast<int>(version.numLevels()); ++level)
+    {
+        double level_score = score(version, level);
+        if (level_score >= 1)
+        {
+            scores.push_back({level_score, level});
+        }
+    }
+    std::sort(scores.begin(), scores.end(), std::greater<std::pair<double, int>>());
+
+    std::vector<int> levels;
+    for (const auto &[level_score, level] : scores)
+    {
+        levels.push_back(level);
+    }
+    return levels;
+}
+
+bool LeveledCompactionPicker::pickCompaction(const Version &version, int level, Compaction &compaction)
+{
+    const auto &files = version.files(level);
+    if (files.empty())
+    {
+        return false;
+    }
+
+    compaction.level = level;
+    compaction.output_level = level + 1;
+    compaction.bottommost = emptyBelow(version, level + 1);
+
+    // Level 0 tables overlap one another, so they go together; deeper levels give
+    // up a single table, which keeps each compaction small
+    std::vector<TableHandle> picked;
+    if (level == 0)
+    {
+        picked = files;
+    }
+    else
+    {
+        if (cursor.size() <= static_cast<size_t>(level))
+        {
+            cursor.resize(level + 1);
+        }
+
+        // Files are sorted by key range; wrap around once the cursor passes the last one
+        std::string &last = cursor[level];
+        auto it = std::find_if(files.begin(), files.end(), [&last](const TableHandle &sst)
+                               { return sst->maxKey > last; });
+        if (last.empty() || it == files.end())
+        {
+            it = files.begin();
+        }
+
+        last = (*it)->maxKey;
+        picked.push_back(*it);
+    }
+
+    std::string minKey = picked[0]->minKey;
+    std::string maxKey = picked[0]->maxKey;
+    for (const auto &sst : picked)
+    {
+        minKey = std::min(minKey, sst->minKey);
+        maxKey = std::max(maxKey, sst->maxKey);
+        compaction.inputs.push_back({sst, level});
+    }
+
+    for (const auto &sst : version.files(level + 1))
+    {
+        bool overlaps = !(sst->maxKey < minKey || sst->minKey > maxKey);
+        if (overlaps)
+        {
+            compaction.inputs.push_back({sst, level + 1});
+        }
+    }
+
+    return true;
+}
+
+UniversalCompactionPicker::UniversalCompactionPicker(const KVStoreOptions &options)
+    : options(options)
+{
+}
+
+std::vector<UniversalCompactionPicker::SortedRun> UniversalCompactionPicker::sortedRuns(const Version &version)
+{
+    std::vector<SortedRun> runs;
+
+    const auto &level0 = version.files(0);
+    for (auto it = level0.rbegin(); it != level0.rend(); ++it)
+    {
+        runs.push_back({0, {*it}, static_cast<uint64_t>((*it)->fileSize)});
+    }
+
+    for (size_t level = 1; level < version.numLevels(); ++level)
+    {
+        const auto &files = version.files(level);
+        if (!files.empty())
+        {
+            runs.push_back({static_cast<int>(level), files, totalBytes(files)});
+        }
+    }
+
+    return runs;
+}
+
+std::vector<int> UniversalCompactionPicker::levelsToCompact(const Version &version) const
+{
+    // A merge always starts from a run at or below level 0, so it is queued there
+    if (sortedRuns(version).size() >= std::max<size_t>(options.level0_compaction_trigger, 2))
+    {
+        return {0};
+    }
+    return {};
+}
+
+bool UniversalCompactionPicker::pickCompaction(const Version &version, int /*level*/, Compaction &compaction)
+{
+    std::vector<SortedRun> runs = sortedRuns(version);
+    size_t trigger = std::max<size_t>(options.level0_compaction_trigger, 2);
+    if (runs.size() < trigger)
+    {
+        return false;
+    }
+
+    // Runs first..last (newest to oldest) are merged
+    size_t first = 0;
+    size_t last = 0;
+    bool picked = false;
+
+    // Space amplification: the newer runs hold more bytes than the oldest can
+    // justify, so everything is merged into one run
+    uint64_t newer = 0;
+    for (size_t i = 0; i + 1 < runs.size(); ++i)
+    {
+        newer += runs[i].bytes;
+    }
+    if (newer * 100 >= static_cast<uint64_t>(options.universal_max_size_amplification_percent) * runs.back().bytes)
+    {
+        last = runs.size() - 1;
+        picked = true;
+    }
+
+    // Size ratio: from the newest run that starts one, the longest stretch of runs
+    // each no bigger than all of the ones before it together (plus the ratio)
+    for (size_t start = 0; !picked && start + 1 < runs.size(); ++start)
+    {
+        uint64_t merged = runs[start].bytes;
+        size_t end = start;
+        while (end + 1 < runs.size() && runs[end + 1].bytes * 100 <= merged * (100 + options.universal_size_ratio))
+        {
+            merged += runs[++end].bytes;
+        }
+
+        if (end - start + 1 >= static_cast<size_t>(std::max(options.universal_min_merge_width, 2)))
+        {
+            first = start;
+            last = end;
+            picked = true;
+        }
+    }
+
+    // Run count: merge the newest runs, just enough of them to go back under the trigger
+    if (!picked)
+    {
+        last = runs.size() - trigger + 1;
+    }
+
+    // The output lands below level 0, so every older level 0 table must go with it
+    // or it would read as newer than the merged data
+    if (runs[last].level == 0)
+    {
+        while (last + 1 < runs.size() && runs[last + 1].level == 0)
+        {
+            last++;
+        }
+    }
+
+    // The merged run sinks to the level just above the next older run (the deepest
+    // level if there is none), which keeps the levels above free for newer runs.
+    // With no level free there it takes that run and the ones packed directly
+    // below it, so the result can sink past them into the first free level.
+    auto levelAboveOlder = [&]()
+    {
+        return last + 1 < runs.size() ? runs[last + 1].level - 1 : std::max(options.num_levels - 1, runs[last].level);
+    };
+    int output_level = levelAboveOlder();
+    if (output_level == 0)
+    {
+        do
+        {
+            last++;
+        } while (last + 1 < runs.size() && runs[last + 1].level == runs[last].level + 1);
+        output_level = levelAboveOlder();
+    }
+
+    compaction.level = runs[first].level;
+    compaction.output_level = output_level;
+    compaction.bottommost = last + 1 == runs.size();
+    for (size_t i = first; i <= last; ++i)
+    {
+        for (const auto &sst : runs[i].tables)
+        {
+            compaction.inputs.push_back({sst, runs[i].level});
+        }
+    }
+
+    return true;
+}
+
+std::unique_ptr<CompactionPicker> newCompactionPicker(const KVStoreOptions &options)
+{
+    if (options.compaction_style == CompactionStyle::Universal)
+    {
+        return std::make_unique<UniversalCompactionPicker>(options);
+    }
+    return std::make_unique<LeveledCompactionPicker>(options);
+}
@@ -0,0 +1,264 @@
+#include "compression.h"
+#include "format.h"
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+// Compressed stream: [varint32 uncompressed size] sequence*
+// sequence = [token][literal length ext]*[literals][fixed16 offset][match length ext]*
+// The token's high nibble is the literal length and its low nibble the match length - 4;
+// a nibble of 15 continues in 255-valued extension bytes. The last sequence carries
+// literals only and ends the stream.
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+// Matches never start in the last bytes, so the final sequence always has literals
+const size_t MATCH_FIND_LIMIT = 12;
+const size_t LAST_LITERALS = 5;
+const int HASH_BITS = 14;
+
+inline uint32_t load32(const char *p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+void putLength(std::string &dst, size_t length)
+{
+    while (length >= 255)
+    {
+        dst.push_back(static_cast<char>(255));
+        length -= 255;
+    }
+    dst.push_back(static_cast<char>(length));
+}
+
+bool getLength(std::string_view &input, size_t &length)
+{
+    uint8_t byte;
+    do
+    {
+        if (input.empty())
+        {
+            return false;
+        }
+        byte = static_cast<uint8_t>(input.front());
+        input.remove_prefix(1);
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+void emitSequence(std::string &dst, const char *literals, size_t literal_len, size_t offset, size_t match_len)
+{
+    size_t match_code = match_len - MIN_MATCH;
+    uint8_t token = static_cast<uint8_t>((std::min<size_t>(literal_len, 15) << 4) | std::min<size_t>(match_code, 15));
+
+    dst.push_back(static_cast<char>(token));
+    if (literal_len >= 15)
+    {
+        putLength(dst, literal_len - 15);
+    }
+    dst.append(literals, literal_len);
+
+    dst.push_back(static_cast<char>(offset & 0xff));
+    dst.push_back(static_cast<char>(offset >> 8));
+    if (match_code >= 15)
+    {
+        putLength(dst, match_code - 15);
+    }
+}
+
+void emitLastLiterals(std::string &dst, const char *literals, size_t literal_len)
+{
+    dst.push_back(static_cast<char>(std::min<size_t>(literal_len, 15) << 4));
+    if (literal_len >= 15)
+    {
+        putLength(dst, literal_len - 15);
+    }
+    dst.append(literals, literal_len);
+}
+
+void compressLZ(std::string_view input, std::string &output)
+{
+    output.clear();
+    putVarint32(output, input.size());
+
+    const char *src = input.data();
+    size_t n = input.size();
+    size_t anchor = 0;
+
+    if (n >= MATCH_FIND_LIMIT + 1)
+    {
+        // Positions + 1, so 0 means empty
+        std::vector<uint32_t> table(1 << HASH_BITS, 0);
+        size_t match_limit = n - LAST_LITERALS;
+        size_t ip = 0;
+        size_t misses = 0;
+
+        while (ip + MATCH_FIND_LIMIT < n)
+        {
+            uint32_t sequence = load32(src + ip);
+            uint32_t h = hash32(sequence);
+            size_t candidate = table[h];
+            table[h] = ip + 1;
+
+            if (candidate == 0 || ip - (candidate - 1) > MAX_OFFSET || load32(src + candidate - 1) != sequence)
+            {
+                // Step faster through data that keeps failing to match
+                ip += 1 + (misses++ >> 5);
+                continue;
+            }
+
+            size_t ref = candidate - 1;
+            size_t length = MIN_MATCH;
+            while (ip + length < match_limit && src[ref + length] == src[ip + length])
+            {
+                length++;
+            }
+
+            emitSequence(output, src + anchor, ip - anchor, ip - ref, length);
+            ip += length;
+            anchor = ip;
+            misses = 0;
+        }
+    }
+
+    emitLastLiterals(output, src + anchor, n - anchor);
+}
+
+bool uncompressLZ(std::string_view input, std::string &output)
+{
+    uint32_t raw_size;
+    if (!getVarint32(input, raw_size))
+    {
+        return false;
+    }
+
+    output.resize(raw_size);
+    char *dst = output.data();
+    size_t op = 0;
+
+    while (true)
+    {
+        if (input.empty())
+        {
+            return false;
+        }
+
+        uint8_t token = static_cast<uint8_t>(input.front());
+        input.remove_prefix(1);
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !getLength(input, literal_len))
+        {
+            return false;
+        }
+        if (literal_len > input.size() || literal_len > raw_size - op)
+        {
+            return false;
+        }
+        std::memcpy(dst + op, input.data(), literal_len);
+        input.remove_prefix(literal_len);
+        op += literal_len;
+
+        if (input.empty())
+        {
+            return op == raw_size;
+        }
+
+        if (input.size() < 2)
+        {
+            return false;
+        }
+        size_t offset = static_cast<uint8_t>(input[0]) | (static_cast<uint8_t>(input[1]) << 8);
+        input.remove_prefix(2);
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && !getLength(input, match_len))
+        {
+            return false;
+        }
+        match_len += MIN_MATCH;
+
+        if (offset == 0 || offset > op || match_len > raw_size - op)
+        {
+            return false;
+        }
+
+        // Byte-wise copy: the source may overlap the bytes being written
+        const char *from = dst + op - offset;
+        for (size_t i = 0; i < match_len; i++)
+        {
+            dst[op + i] = from[i];
+        }
+        op += match_len;
+    }
+}
+}
+
+bool compressBlock(CompressionType type, std::string_view input, std::string &output)
+{
+    switch (type)
+    {
+    case CompressionType::None:
+        output.assign(input.data(), input.size());
+        return true;
+    case CompressionType::LZ:
+        compressLZ(input, output);
+        return true;
+    }
+    return false;
+}
+
+bool uncompressBlock(CompressionType type, std::string_view input, std::string &output)
+{
+    switch (type)
+    {
+    case CompressionType::None:
+        output.assign(input.data(), input.size());
+        return true;
+    case CompressionType::LZ:
+        return uncompressLZ(input, output);
+    }
+    return false;
+}
+
+double CompressionStats::Snapshot::ratio() const
+{
+    return stored_bytes == 0 ? 1.0 : static_cast<double>(raw_bytes) / stored_bytes;
+}
+
+void CompressionStats::recordCompress(size_t raw, size_t stored, bool compressed, uint64_t nanos)
+{
+    raw_bytes.fetch_add(raw, std::memory_order_relaxed);
+    stored_bytes.fetch_add(stored, std::memory_order_relaxed);
+    (compressed ? blocks_compressed : blocks_stored_raw).fetch_add(1, std::memory_order_relaxed);
+    compress_nanos.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+void CompressionStats::recordDecompress(uint64_t nanos)
+{
+    blocks_decompressed.fetch_add(1, std::memory_order_relaxed);
+    decompress_nanos.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+CompressionStats::Snapshot CompressionStats::snapshot() const
+{
+    Snapshot result;
+    result.raw_bytes = raw_bytes.load(std::memory_order_relaxed);
+    result.stored_bytes = stored_bytes.load(std::memory_order_relaxed);
+    result.blocks_compressed = blocks_compressed.load(std::memory_order_relaxed);
+    result.blocks_stored_raw = blocks_stored_raw.load(std::memory_order_relaxed);
+    result.compress_nanos = compress_nanos.load(std::memory_order_relaxed);
+    result.blocks_decompressed = blocks_decompressed.load(std::memory_order_relaxed);
+    result.decompress_nanos = decompress_nanos.load(std::memory_order_relaxed);
+    return result;
+}
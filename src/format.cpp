@@ -0,0 +1,222 @@
+#include "format.h"
+#include <cstring>
+
+void putFixed32(std::string &dst, uint32_t value)
+{
+    char buf[4];
+    for (int i = 0; i < 4; i++)
+    {
+        buf[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+    dst.append(buf, 4);
+}
+
+void putFixed64(std::string &dst, uint64_t value)
+{
+    char buf[8];
+    for (int i = 0; i < 8; i++)
+    {
+        buf[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+    dst.append(buf, 8);
+}
+
+void putVarint32(std::string &dst, uint32_t value)
+{
+    putVarint64(dst, value);
+}
+
+void putVarint64(std::string &dst, uint64_t value)
+{
+    char buf[10];
+    int len = 0;
+    while (value >= 0x80)
+    {
+        buf[len++] = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = static_cast<char>(value);
+    dst.append(buf, len);
+}
+
+void putLengthPrefixed(std::string &dst, std::string_view value)
+{
+    putVarint32(dst, value.size());
+    dst.append(value.data(), value.size());
+}
+
+uint32_t decodeFixed32(const char *ptr)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(ptr);
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint64_t decodeFixed64(const char *ptr)
+{
+    return static_cast<uint64_t>(decodeFixed32(ptr)) | (static_cast<uint64_t>(decodeFixed32(ptr + 4)) << 32);
+}
+
+bool getFixed32(std::string_view &input, uint32_t &value)
+{
+    if (input.size() < 4)
+    {
+        return false;
+    }
+    value = decodeFixed32(input.data());
+    input.remove_prefix(4);
+    return true;
+}
+
+bool getFixed64(std::string_view &input, uint64_t &value)
+{
+    if (input.size() < 8)
+    {
+        return false;
+    }
+    value = decodeFixed64(input.data());
+    input.remove_prefix(8);
+    return true;
+}
+
+bool getVarint32(std::string_view &input, uint32_t &value)
+{
+    uint64_t v;
+    if (!getVarint64(input, v) || v > UINT32_MAX)
+    {
+        return false;
+    }
+    value = static_cast<uint32_t>(v);
+    return true;
+}
+
+bool getVarint64(std::string_view &input, uint64_t &value)
+{
+    uint64_t result = 0;
+    for (size_t i = 0; i < input.size() && i < 10; i++)
+    {
+        uint64_t byte = static_cast<uint8_t>(input[i]);
+        result |= (byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0)
+        {
+            value = result;
+            input.remove_prefix(i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool getLengthPrefixed(std::string_view &input, std::string_view &value)
+{
+    uint32_t len;
+    if (!getVarint32(input, len) || input.size() < len)
+    {
+        return false;
+    }
+    value = input.substr(0, len);
+    input.remove_prefix(len);
+    return true;
+}
+
+void BlockHandle::encodeTo(std::string &dst) const
+{
+    putVarint64(dst, offset);
+    putVarint64(dst, size);
+}
+
+bool BlockHandle::decodeFrom(std::string_view &input)
+{
+    return getVarint64(input, offset) && getVarint64(input, size);
+}
+
+std::string Footer::encode() const
+{
+    std::string dst;
+    putFixed64(dst, filter.offset);
+    putFixed64(dst, filter.size);
+    putFixed64(dst, properties.offset);
+    putFixed64(dst, properties.size);
+    putFixed64(dst, index.offset);
+    putFixed64(dst, index.size);
+    putFixed32(dst, version);
+    putFixed64(dst, MAGIC);
+    return dst;
+}
+
+bool Footer::decode(std::string_view input)
+{
+    if (input.size() != ENCODED_LENGTH || decodeFixed64(input.data() + ENCODED_LENGTH - 8) != MAGIC)
+    {
+        return false;
+    }
+
+    getFixed64(input, filter.offset);
+    getFixed64(input, filter.size);
+    getFixed64(input, properties.offset);
+    getFixed64(input, properties.size);
+    getFixed64(input, index.offset);
+    getFixed64(input, index.size);
+    getFixed32(input, version);
+    return true;
+}
+
+bool coveredByAny(const std::vector<RangeTombstone> &tombstones, std::string_view key, uint64_t snapshot)
+{
+    for (const auto &tombstone : tombstones)
+    {
+        if (tombstone.sequence <= snapshot && tombstone.covers(key))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t hiddenFrom(const std::vector<RangeTombstone> &tombstones, std::string_view key, uint64_t sequence)
+{
+    uint64_t from = MAX_SEQUENCE_NUMBER + 1;
+    for (const auto &tombstone : tombstones)
+    {
+        if (tombstone.sequence > sequence && tombstone.sequence < from && tombstone.covers(key))
+        {
+            from = tombstone.sequence;
+        }
+    }
+    return from;
+}
+
+std::string encodeRangeTombstones(const std::vector<RangeTombstone> &tombstones)
+{
+    std::string dst;
+    putVarint32(dst, tombstones.size());
+    for (const auto &tombstone : tombstones)
+    {
+        putLengthPrefixed(dst, tombstone.begin);
+        putLengthPrefixed(dst, tombstone.end);
+        putVarint64(dst, tombstone.sequence);
+    }
+    return dst;
+}
+
+bool decodeRangeTombstones(std::string_view input, std::vector<RangeTombstone> &tombstones, bool sequenced)
+{
+    uint32_t count;
+    if (!getVarint32(input, count))
+    {
+        return false;
+    }
+
+    tombstones.clear();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        std::string_view begin, end;
+        uint64_t sequence = 0;
+        if (!getLengthPrefixed(input, begin) || !getLengthPrefixed(input, end) || (sequenced && !getVarint64(input, sequence)))
+        {
+            return false;
+        }
+        tombstones.push_back({std::string(begin), std::string(end), sequence});
+    }
+    return input.empty();
+}
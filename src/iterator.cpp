@@ -0,0 +1,433 @@
+#include "iterator.h"
+#include <algorithm>
+
+MemTableIterator::MemTableIterator(const MemTable *table, uint64_t snapshot) : iter(table, snapshot) {}
+
+bool MemTableIterator::valid() const
+{
+    return iter.valid();
+}
+
+void MemTableIterator::seekToFirst()
+{
+    iter.seekToFirst();
+}
+
+void MemTableIterator::seekToLast()
+{
+    iter.seekToLast();
+}
+
+void MemTableIterator::seek(std::string_view target)
+{
+    iter.seek(target);
+}
+
+void MemTableIterator::next()
+{
+    iter.next();
+}
+
+void MemTableIterator::prev()
+{
+    iter.prev();
+}
+
+std::string_view MemTableIterator::key() const
+{
+    return iter.key();
+}
+
+std::string_view MemTableIterator::value() const
+{
+    return iter.value();
+}
+
+ValueType MemTableIterator::type() const
+{
+    return iter.type();
+}
+
+MergingIterator::MergingIterator(std::vector<std::unique_ptr<InternalIterator>> children)
+    : children(std::move(children))
+{
+}
+
+bool MergingIterator::valid() const
+{
+    return current != nullptr;
+}
+
+void MergingIterator::seekToFirst()
+{
+    for (auto &child : children)
+    {
+        child->seekToFirst();
+    }
+    forward = true;
+    findSmallest();
+}
+
+void MergingIterator::seekToLast()
+{
+    for (auto &child : children)
+    {
+        child->seekToLast();
+    }
+    forward = false;
+    findLargest();
+}
+
+void MergingIterator::seek(std::string_view target)
+{
+    for (auto &child : children)
+    {
+        child->seek(target);
+    }
+    forward = true;
+    findSmallest();
+}
+
+void MergingIterator::next()
+{
+    std::string key(current->key());
+
+    // Coming from prev() the other children sit before key; bring them to key or past it
+    if (!forward)
+    {
+        for (auto &child : children)
+        {
+            child->seek(key);
+        }
+        forward = true;
+    }
+
+    // Step every child at key, which also drops the shadowed versions
+    for (auto &child : children)
+    {
+        if (child->valid() && child->key() == key)
+        {
+            child->next();
+        }
+    }
+
+    findSmallest();
+}
+
+void MergingIterator::prev()
+{
+    std::string key(current->key());
+
+    if (forward)
+    {
+        // Every child moves to its last entry before key
+        for (auto &child : children)
+        {
+            child->seek(key);
+            if (child->valid())
+            {
+                child->prev();
+            }
+            else
+            {
+                child->seekToLast();
+            }
+        }
+        forward = false;
+    }
+    else
+    {
+        for (auto &child : children)
+        {
+            if (child->valid() && child->key() == key)
+            {
+                child->prev();
+            }
+        }
+    }
+
+    findLargest();
+}
+
+std::string_view MergingIterator::key() const
+{
+    return current->key();
+}
+
+std::string_view MergingIterator::value() const
+{
+    return current->value();
+}
+
+ValueType MergingIterator::type() const
+{
+    return current->type();
+}
+
+bool MergingIterator::ok() const
+{
+    return std::all_of(children.begin(), children.end(), [](const auto &child)
+                       { return child->ok(); });
+}
+
+void MergingIterator::findSmallest()
+{
+    // Strict comparison keeps the earliest (newest) child on ties
+    current = nullptr;
+    for (auto &child : children)
+    {
+        if (child->valid() && (current == nullptr || child->key() < current->key()))
+        {
+            current = child.get();
+        }
+    }
+}
+
+void MergingIterator::findLargest()
+{
+    current = nullptr;
+    for (auto &child : children)
+    {
+        if (child->valid() && (current == nullptr || child->key() > current->key()))
+        {
+            current = child.get();
+        }
+    }
+}
+
+LevelIterator::LevelIterator(std::vector<std::string> max_keys, FileOpener open_file)
+    : max_keys(std::move(max_keys)), open_file(std::move(open_file)), file_index(0)
+{
+}
+
+bool LevelIterator::valid() const
+{
+    return file_iter && file_iter->valid();
+}
+
+void LevelIterator::seekToFirst()
+{
+    openFile(0);
+    if (file_iter)
+    {
+        file_iter->seekToFirst();
+    }
+    skipEmptyFilesForward();
+}
+
+void LevelIterator::seekToLast()
+{
+    if (max_keys.empty())
+    {
+        closeFile();
+        return;
+    }
+
+    openFile(max_keys.size() - 1);
+    if (file_iter)
+    {
+        file_iter->seekToLast();
+    }
+    skipEmptyFilesBackward();
+}
+
+void LevelIterator::seek(std::string_view target)
+{
+    // First file whose largest key is >= target
+    auto it = std::lower_bound(max_keys.begin(), max_keys.end(), target,
+                               [](const std::string &max_key, std::string_view t)
+                               { return max_key < t; });
+
+    openFile(it - max_keys.begin());
+    if (file_iter)
+    {
+        file_iter->seek(target);
+    }
+    skipEmptyFilesForward();
+}
+
+void LevelIterator::next()
+{
+    file_iter->next();
+    skipEmptyFilesForward();
+}
+
+void LevelIterator::prev()
+{
+    file_iter->prev();
+    skipEmptyFilesBackward();
+}
+
+std::string_view LevelIterator::key() const
+{
+    return file_iter->key();
+}
+
+std::string_view LevelIterator::value() const
+{
+    return file_iter->value();
+}
+
+ValueType LevelIterator::type() const
+{
+    return file_iter->type();
+}
+
+bool LevelIterator::ok() const
+{
+    return !corrupt && (!file_iter || file_iter->ok());
+}
+
+void LevelIterator::openFile(size_t file)
+{
+    file_index = file;
+    closeFile();
+    if (file < max_keys.size())
+    {
+        file_iter = open_file(file);
+    }
+}
+
+void LevelIterator::closeFile()
+{
+    if (file_iter && !file_iter->ok())
+    {
+        corrupt = true;
+    }
+    file_iter.reset();
+}
+
+void LevelIterator::skipEmptyFilesForward()
+{
+    while (!valid())
+    {
+        if (file_index + 1 >= max_keys.size())
+        {
+            closeFile();
+            return;
+        }
+
+        openFile(file_index + 1);
+        if (file_iter)
+        {
+            file_iter->seekToFirst();
+        }
+    }
+}
+
+void LevelIterator::skipEmptyFilesBackward()
+{
+    while (!valid())
+    {
+        if (file_index == 0 || file_index > max_keys.size())
+        {
+            closeFile();
+            return;
+        }
+
+        openFile(file_index - 1);
+        if (file_iter)
+        {
+            file_iter->seekToLast();
+        }
+    }
+}
+
+RangeTombstoneFilter::RangeTombstoneFilter(std::unique_ptr<InternalIterator> child, std::vector<RangeTombstone> tombstones)
+    : child(std::move(child)), tombstones(std::move(tombstones))
+{
+}
+
+bool RangeTombstoneFilter::valid() const
+{
+    return child->valid();
+}
+
+void RangeTombstoneFilter::seekToFirst()
+{
+    child->seekToFirst();
+    skipCoveredForward();
+}
+
+void RangeTombstoneFilter::seekToLast()
+{
+    child->seekToLast();
+    skipCoveredBackward();
+}
+
+void RangeTombstoneFilter::seek(std::string_view target)
+{
+    child->seek(target);
+    skipCoveredForward();
+}
+
+void RangeTombstoneFilter::next()
+{
+    child->next();
+    skipCoveredForward();
+}
+
+void RangeTombstoneFilter::prev()
+{
+    child->prev();
+    skipCoveredBackward();
+}
+
+std::string_view RangeTombstoneFilter::key() const
+{
+    return child->key();
+}
+
+std::string_view RangeTombstoneFilter::value() const
+{
+    return child->value();
+}
+
+ValueType RangeTombstoneFilter::type() const
+{
+    return child->type();
+}
+
+bool RangeTombstoneFilter::ok() const
+{
+    return child->ok();
+}
+
+void RangeTombstoneFilter::skipCoveredForward()
+{
+    while (child->valid())
+    {
+        // Jump to the end of the covering tombstone rather than stepping through it
+        auto covering = std::find_if(tombstones.begin(), tombstones.end(), [this](const RangeTombstone &t)
+                                     { return t.covers(child->key()); });
+        if (covering == tombstones.end())
+        {
+            return;
+        }
+        child->seek(covering->end);
+    }
+}
+
+void RangeTombstoneFilter::skipCoveredBackward()
+{
+    while (child->valid())
+    {
+        auto covering = std::find_if(tombstones.begin(), tombstones.end(), [this](const RangeTombstone &t)
+                                     { return t.covers(child->key()); });
+        if (covering == tombstones.end())
+        {
+            return;
+        }
+
+        // Last entry before the tombstone
+        child->seek(covering->begin);
+        if (child->valid())
+        {
+            child->prev();
+        }
+        else
+        {
+            child->seekToLast();
+        }
+    }
+}
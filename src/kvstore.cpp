@@ -8,375 +8,1464 @@
 #include <sstream>
 #include <set>
 #include <cstdio>
+#include <numeric>
+#include <chrono>
 
 namespace fs = std::filesystem;
 
-KVStore::KVStore(const std::string &filename, const std::string &directory) : data_directory(directory)
+namespace
 {
+uint64_t microsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+}
+
+KVStore::KVStore(const std::string &filename, const std::string &directory, const KVStoreOptions &options)
+    : options(options), data_directory(directory)
+{
+    auto open_start = std::chrono::steady_clock::now();
+
     if (!fs::exists(data_directory)) {
         fs::create_directory(data_directory);
     }
 
-    memtable = std::make_unique<MemTable>();
-    wal = std::make_unique<WAL>(filename);
+    if (options.block_cache_capacity > 0)
+    {
+        block_cache = std::make_unique<BlockCache>(options.block_cache_capacity);
+    }
+    TableReaderOptions reader_options;
+    reader_options.block_cache = block_cache.get();
+    reader_options.stats = &compression_stats;
+    reader_options.verify_checksums = options.verify_checksums;
+    table_cache = std::make_unique<TableCache>(options.max_open_files, reader_options);
+
+    loadSSTables();
+
+    auto wal_start = std::chrono::steady_clock::now();
+    memtable = std::make_shared<MemTable>();
+    wal = std::make_unique<WAL>(filename, options.wal_sync_policy, options.wal_sync_interval_ms);
     
     std::string tmp_file_path = filename + ".tmp";
 
+    // A leftover rotated log belongs to a memtable whose flush never finished.
+    // Persist it now so the next rotation cannot overwrite it; if that fails it
+    // becomes the immutable memtable, which holds off rotation until the flush
+    // thread gets it written.
     if (fs::exists(tmp_file_path)) {
-        auto tmp_history = wal->readAllFromFile(tmp_file_path);
+        auto recovered = std::make_shared<MemTable>();
+        bool flushed = false;
+        replayLog(tmp_file_path, recovered, flushed);
+
+        if (flushMemTable(*recovered))
+        {
+            wal->clearTemp();
+        }
+        else
+        {
+            std::cerr << "Failed to flush the memtable recovered from " << tmp_file_path << "; keeping the log" << std::endl;
+            immutable_memtable = std::move(recovered);
+            flush_pending = true;
+        }
+    }
+
+    bool flushed = false;
+    startup_stats.wal_entries = replayLog(filename, memtable, flushed, true);
+
+    // Part of the log is already in tables; persist the rest too so the log can
+    // be emptied and the next open does not write the same tables again
+    if (flushed && flushMemTable(*memtable))
+    {
+        memtable = std::make_shared<MemTable>();
+        wal->clear();
+    }
+    visible_sequence = next_sequence - 1;
+
+    if (startup_stats.wal_entries > 0)
+    {
+        std::cout << "Loaded " << startup_stats.wal_entries << " entries from WAL" << std::endl;
+    }
+    else
+    {
+        std::cout << "No history found in WAL" << std::endl;
+    }
+
+    startup_stats.wal_micros = microsSince(wal_start);
+    startup_stats.total_micros = microsSince(open_start);
+    std::cout << "Opened in " << startup_stats.total_micros / 1000.0 << " ms (MANIFEST " << startup_stats.manifest_micros / 1000.0
+              << ", tables " << startup_stats.table_load_micros / 1000.0 << " on " << startup_stats.table_loading_threads << " threads, cleanup "
+              << startup_stats.cleanup_micros / 1000.0 << ", WAL " << startup_stats.wal_micros / 1000.0 << ")" << std::endl;
+
+    compaction_picker = newCompactionPicker(this->options);
+    compaction_pool = std::make_unique<ThreadPool>(options.compaction_threads);
+    flush_thread = std::thread(&KVStore::flushLoop, this);
+
+    maybeScheduleCompaction();
+}
+
+KVStore::~KVStore()
+{
+    {
+        std::lock_guard<std::mutex> lock(flush_mutex);
+        shutting_down = true;
+    }
+    flush_cv.notify_all();
+
+    if (flush_thread.joinable())
+    {
+        flush_thread.join();
+    }
+
+    // Lets running compactions finish; queued ones are picked up again on the next open
+    compaction_pool.reset();
+}
+
+size_t KVStore::replayLog(const std::string &path, std::shared_ptr<MemTable> &mem, bool &flushed, bool truncate_torn_tail)
+{
+    int threads = options.wal_recovery_threads > 0 ? options.wal_recovery_threads : std::max(1u, std::thread::hardware_concurrency());
+    bool flush_failed = false;
+
+    // Records from before sequence numbers are numbered in log order after every
+    // table; numbered records move the counter past their own numbers
+    return WAL::replayFile(path, [&](ValueType type, std::string_view key, std::string_view value, uint64_t sequence)
+                           {
+        if (sequence == 0)
+        {
+            sequence = next_sequence++;
+        }
+        else if (sequence >= next_sequence)
+        {
+            next_sequence = sequence + 1;
+        }
+
+        applyEntry(*mem, type, key, value, sequence);
+        // After a failed flush the rest of the log stays in memory, as it does behind
+        // an older memtable still waiting for its flush: level 0 is ordered by file id
+        if (!flush_failed && !immutable_memtable && memtableFull(*mem))
+        {
+            if (flushMemTable(*mem))
+            {
+                mem = std::make_shared<MemTable>();
+                flushed = true;
+            }
+            else
+            {
+                flush_failed = true;
+            }
+        } }, threads, truncate_torn_tail);
+}
+
+void KVStore::loadSSTables()
+{
+    auto phase_start = std::chrono::steady_clock::now();
+    manifest = std::make_unique<Manifest>(data_directory);
+
+    std::vector<ManifestTable> tables;
+    int manifest_next_file_id = 1;
+    Manifest::Status status = manifest->recover(tables, manifest_next_file_id);
+    bool from_manifest = status == Manifest::Status::Ok;
+
+    if (from_manifest)
+    {
+        next_file_id = manifest_next_file_id;
+    }
+    else
+    {
+        // A store from before the MANIFEST, or one whose log is damaged, is rebuilt
+        // from the table files themselves
+        if (status == Manifest::Status::Corrupt)
+        {
+            std::cerr << "Rebuilding level metadata from the SSTables in " << data_directory << std::endl;
+        }
+        tables = scanTableFiles();
+    }
+
+    startup_stats.manifest_micros = microsSince(phase_start);
+    phase_start = std::chrono::steady_clock::now();
+
+    // Tables are opened in parallel, each into its own slot; missing or unreadable
+    // files leave theirs empty
+    std::vector<SSTableMetadata *> loaded(tables.size(), nullptr);
+    std::vector<char> unreadable(tables.size(), false);
+    auto loadTable = [&](size_t i)
+    {
+        const ManifestTable &table = tables[i];
+        std::string full_path = fs::absolute(fs::path(data_directory) / table.filename).lexically_normal().string();
+        if (!fs::exists(full_path))
+        {
+            std::cerr << "SSTable listed in the MANIFEST is missing: " << full_path << std::endl;
+            return;
+        }
+
+        // Only the footer and meta blocks are read
+        BloomFilter bf;
+        TableProperties props;
+        std::vector<RangeTombstone> tombstones;
+        std::vector<IndexEntry> index;
+        if (!SSTable::loadIndex(full_path, index, bf, &props, bloomBitsPerKey(table.level), &tombstones))
+        {
+            unreadable[i] = true;
+            return;
+        }
+
+        SSTableMetadata *metadata = new SSTableMetadata{full_path, index, bf, table.fileId, table.minKey, table.maxKey, static_cast<long>(table.fileSize), props.format_version, tombstones, table.largestSequence};
+        if (!from_manifest)
+        {
+            metadata->minKey = props.min_key;
+            metadata->maxKey = props.max_key;
+            metadata->largestSequence = props.largest_sequence;
+        }
+        loaded[i] = metadata;
+    };
+
+    size_t threads = options.table_loading_threads > 0 ? options.table_loading_threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::max<size_t>(1, std::min(threads, tables.size()));
+    if (threads == 1)
+    {
+        for (size_t i = 0; i < tables.size(); i++)
+        {
+            loadTable(i);
+        }
+    }
+    else
+    {
+        // The pool's destructor waits for every submitted table
+        ThreadPool pool(threads);
+        for (size_t i = 0; i < tables.size(); i++)
+        {
+            pool.submit([&loadTable, i]
+                        { loadTable(i); });
+        }
+    }
+
+    // Assembled in the order the tables were listed, however the loads finished
+    // An unreadable table is left out rather than served with its data missing. Its
+    // file and MANIFEST record are kept, so it is never removed as an orphan, and its
+    // sequences are never reused.
+    std::vector<std::vector<TableHandle>> levels(1);
+    std::vector<ManifestTable> unloaded;
+    std::vector<size_t> readmitted;
+    for (size_t i = 0; i < tables.size(); i++)
+    {
+        if (unreadable[i])
+        {
+            std::cerr << "Leaving out unreadable SSTable " << tables[i].filename << "; its data is not served" << std::endl;
+            unloaded.push_back(tables[i]);
+            unloaded.back().unloaded = true;
+            next_file_id = std::max(next_file_id.load(), tables[i].fileId + 1);
+            next_sequence = std::max(next_sequence.load(), tables[i].largestSequence + 1);
+            continue;
+        }
+        if (!loaded[i])
+        {
+            continue;
+        }
+
+        next_file_id = std::max(next_file_id.load(), loaded[i]->fileId + 1);
+        next_sequence = std::max(next_sequence.load(), loaded[i]->largestSequence + 1);
+        if (tables[i].unloaded)
+        {
+            readmitted.push_back(i);
+            continue;
+        }
+
+        int level = tables[i].level;
+        if (levels.size() <= static_cast<size_t>(level))
+        {
+            levels.resize(level + 1);
+        }
+        levels[level].push_back(newTableHandle(loaded[i], table_cache.get()));
+        startup_stats.tables_loaded++;
+    }
+
+    // A table left out by an earlier open that reads again may since have been
+    // overtaken: writes to its key range can have been compacted into its level or
+    // below. It is taken back only if no table of its level overlaps it (newer level 0
+    // tables shadow it anyway) and nothing overlapping it deeper down is newer.
+    for (size_t i : readmitted)
+    {
+        const SSTableMetadata *sst = loaded[i];
+        size_t level = tables[i].level;
+        bool overtaken = false;
+        for (size_t l = std::max<size_t>(level, 1); l < levels.size() && !overtaken; l++)
+        {
+            for (const auto &other : levels[l])
+            {
+                bool overlaps = !(other->maxKey < sst->minKey || other->minKey > sst->maxKey);
+                if (overlaps && (l == level || other->largestSequence > sst->largestSequence))
+                {
+                    overtaken = true;
+                    break;
+                }
+            }
+        }
+
+        if (overtaken)
+        {
+            std::cerr << "Leaving out SSTable " << tables[i].filename << ": tables written since it was left out overlap it" << std::endl;
+            unloaded.push_back(tables[i]);
+            delete loaded[i];
+            continue;
+        }
+
+        if (levels.size() <= level)
+        {
+            levels.resize(level + 1);
+        }
+        levels[level].push_back(newTableHandle(loaded[i], table_cache.get()));
+        startup_stats.tables_loaded++;
+    }
+
+    startup_stats.table_load_micros = microsSince(phase_start);
+    startup_stats.table_loading_threads = threads;
+    phase_start = std::chrono::steady_clock::now();
+
+    auto version = std::make_shared<Version>(std::move(levels));
+    std::atomic_store(&current_version, std::shared_ptr<const Version>(version));
+
+    if (from_manifest)
+    {
+        removeOrphanedTables(*version, unloaded);
+    }
+
+    // Starts a fresh log holding just the loaded version
+    if (!manifest->create(*version, next_file_id, unloaded))
+    {
+        std::cerr << "Failed to create the MANIFEST; flushes and compactions will fail" << std::endl;
+    }
+
+    startup_stats.cleanup_micros = microsSince(phase_start);
+
+    std::cout << "Loaded " << startup_stats.tables_loaded << " SSTables across " << version->numLevels() << " levels" << std::endl;
+}
+
+std::vector<ManifestTable> KVStore::scanTableFiles()
+{
+    std::vector<ManifestTable> tables;
+    int max_file_id = 0;
+
+    for (const auto &entry : fs::directory_iterator(data_directory))
+    {
+        if (entry.path().extension() != ".sst")
+        {
+            continue;
+        }
+
+        std::string filename = entry.path().filename().string();
+
+        int level = 0;
+        int fileId = 0;
+
+        if (filename.find("level_") == 0)
+        {
+            if (sscanf(filename.c_str(), "level_%d_%d.sst", &level, &fileId) != 2)
+            {
+                continue;
+            }
+        }
+
+        tables.push_back({level, fileId, filename, static_cast<uint64_t>(entry.file_size()), "", "", 0});
+        max_file_id = std::max(max_file_id, fileId);
+    }
+
+    // Older table names carry no file id; give them fresh ones so ids stay unique
+    for (auto &table : tables)
+    {
+        if (table.fileId == 0)
+        {
+            table.fileId = ++max_file_id;
+        }
+    }
+
+    return tables;
+}
+
+void KVStore::removeOrphanedTables(const Version &version, const std::vector<ManifestTable> &unloaded)
+{
+    // Outputs of a flush or compaction that never reached the MANIFEST, and
+    // obsolete inputs a crash kept from being deleted
+    std::set<std::string> live;
+    for (size_t level = 0; level < version.numLevels(); ++level)
+    {
+        for (const auto &sst : version.files(level))
+        {
+            live.insert(fs::path(sst->filename).filename().string());
+        }
+    }
+    for (const auto &table : unloaded)
+    {
+        live.insert(table.filename);
+    }
+
+    for (const auto &entry : fs::directory_iterator(data_directory))
+    {
+        std::string filename = entry.path().filename().string();
+        if (entry.path().extension() == ".sst" && !live.count(filename))
+        {
+            std::error_code ec;
+            fs::remove(entry.path(), ec);
+            std::cout << "Removed orphaned SSTable " << filename << std::endl;
+        }
+    }
+}
+
+std::string KVStore::generateSSTableFilename(int level, int file_id)
+{
+    std::ostringstream oss;
+    oss << data_directory << "/level_" << level << "_" << file_id << ".sst";
+    std::string path = oss.str();
+    return fs::absolute(path).lexically_normal().string();
+}
+
+void KVStore::put(const std::string &key, const std::string &value)
+{
+    writeEntry(ValueType::Value, key, value);
+}
+
+void KVStore::writeEntry(ValueType type, const std::string &key, const std::string &value)
+{
+    bool success;
+    bool memtable_full;
+    uint64_t sequence;
+
+    {
+        std::shared_lock<std::shared_mutex> lock(memtable_mutex);
 
-        for (const auto &[key, value] : tmp_history) {
-            memtable->put(key, value);
+        sequence = next_sequence.fetch_add(1);
+        success = wal->write(key, value, type, sequence);
+
+        if (success)
+        {
+            applyEntry(*memtable, type, key, value, sequence);
+        }
+        memtable_full = memtableFull(*memtable);
+    }
+
+    // A failed write still gives up its number so later writers can publish theirs
+    publishSequence(sequence, sequence);
+
+    if (!success)
+    {
+        std::cerr << "Failed to write to WAL" << std::endl;
+        return;
+    }
+
+    if (memtable_full)
+    {
+        makeRoomForWrite();
+    }
+}
+
+void KVStore::applyEntry(MemTable &mem, ValueType type, std::string_view key, std::string_view value, uint64_t sequence)
+{
+    switch (type)
+    {
+    case ValueType::Value:
+        mem.put(key, value, sequence);
+        break;
+    case ValueType::Deletion:
+        mem.remove(key, sequence);
+        break;
+    case ValueType::RangeDeletion:
+        // An empty or reversed range deletes nothing; logs may still hold one
+        if (key < value)
+        {
+            mem.deleteRange(key, value, sequence);
+        }
+        break;
+    }
+}
+
+void KVStore::publishSequence(uint64_t first, uint64_t last)
+{
+    std::unique_lock<std::mutex> lock(publish_mutex);
+
+    if (visible_sequence.load(std::memory_order_relaxed) + 1 != first)
+    {
+        // An earlier write is still in flight; it publishes this range too. Waiting
+        // keeps a writer's own write visible to it once the call returns.
+        pending_publish[first] = last;
+        publish_cv.wait(lock, [&]
+                        { return visible_sequence.load(std::memory_order_relaxed) >= last; });
+        return;
+    }
+
+    bool waiters = false;
+    auto next = pending_publish.begin();
+    while (next != pending_publish.end() && next->first == last + 1)
+    {
+        last = next->second;
+        next = pending_publish.erase(next);
+        waiters = true;
+    }
+    visible_sequence.store(last, std::memory_order_release);
+
+    if (waiters)
+    {
+        publish_cv.notify_all();
+    }
+}
+
+KVStore::ReadView KVStore::acquireReadView(const ReadOptions &read_options) const
+{
+    ReadView view;
+    while (true)
+    {
+        {
+            std::shared_lock<std::shared_mutex> lock(memtable_mutex);
+            view.mem = memtable;
+            view.imm = immutable_memtable;
+        }
+        view.version = currentVersion();
+
+        if (read_options.snapshot)
+        {
+            view.sequence = read_options.snapshot->sequence();
+            return view;
+        }
+
+        // No snapshot guards the latest sequence, so it is read only once the version
+        // is pinned: a compaction installed afterwards cannot drop what it sees. If
+        // the memtable was switched meanwhile, writes it covers may be in one that is
+        // not pinned, so everything is pinned again.
+        view.sequence = visible_sequence.load(std::memory_order_acquire);
+        std::shared_lock<std::shared_mutex> lock(memtable_mutex);
+        if (memtable == view.mem)
+        {
+            return view;
         }
     }
+}
+
+const Snapshot *KVStore::getSnapshot()
+{
+    return snapshots.acquire(visible_sequence);
+}
+
+void KVStore::releaseSnapshot(const Snapshot *snapshot)
+{
+    snapshots.release(snapshot);
+}
+
+std::shared_ptr<const Version> KVStore::currentVersion() const
+{
+    return std::atomic_load(&current_version);
+}
+
+bool KVStore::installVersion(const VersionEdit &edit)
+{
+    if (!manifest->append(edit, next_file_id))
+    {
+        return false;
+    }
 
-    std::vector<std::pair<std::string, std::string>> history = wal->readAll();
+    std::shared_ptr<const Version> base = currentVersion();
 
-    for (const auto &[key, value] : history)
+    // Readers still holding the base version keep the removed files until they let go
+    for (const auto &[level, file_id] : edit.removed)
+    {
+        for (const auto &sst : base->files(level))
+        {
+            if (sst->fileId == file_id)
+            {
+                sst->obsolete = true;
+            }
+        }
+    }
+
+    std::atomic_store(&current_version, base->apply(edit));
+    return true;
+}
+
+bool KVStore::memtableFull(const MemTable &mem) const
+{
+    return mem.size() >= options.memtable_max_entries || mem.memoryUsage() >= options.memtable_max_bytes;
+}
+
+int KVStore::bloomBitsPerKey(int level) const
+{
+    if (options.bloom_bits_per_key.empty())
+    {
+        return BloomFilter::DEFAULT_BITS_PER_KEY;
+    }
+    size_t index = std::min<size_t>(level, options.bloom_bits_per_key.size() - 1);
+    return options.bloom_bits_per_key[index];
+}
+
+TableBuilderOptions KVStore::tableOptions(int level)
+{
+    TableBuilderOptions table_options;
+    table_options.block_size = options.block_size;
+    table_options.restart_interval = options.block_restart_interval;
+    if (!options.compression_per_level.empty())
+    {
+        size_t index = std::min<size_t>(level, options.compression_per_level.size() - 1);
+        table_options.compression = options.compression_per_level[index];
+    }
+    table_options.stats = &compression_stats;
+    return table_options;
+}
+
+void KVStore::makeRoomForWrite()
+{
+    std::unique_lock<std::mutex> flush_lock(flush_mutex);
+
+    // Only one immutable memtable may exist; stall writers until the previous one is persisted
+    flush_cv.wait(flush_lock, [this]
+                  { return !flush_pending || shutting_down; });
+
+    if (shutting_down)
+    {
+        return;
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> lock(memtable_mutex);
+
+        if (!memtableFull(*memtable))
+        {
+            return;
+        }
+
+        wal->rotate();
+        immutable_memtable = std::move(memtable);
+        memtable = std::make_shared<MemTable>();
+    }
+
+    flush_pending = true;
+    flush_lock.unlock();
+    flush_cv.notify_all();
+}
+
+void KVStore::flushLoop()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(flush_mutex);
+            flush_cv.wait(lock, [this]
+                          { return flush_pending || shutting_down; });
+
+            if (!flush_pending)
+            {
+                return;
+            }
+        }
+
+        std::shared_ptr<MemTable> imm;
+        {
+            std::shared_lock<std::shared_mutex> lock(memtable_mutex);
+            imm = immutable_memtable;
+        }
+
+        // The rotated log is the only other copy of the memtable, so both are kept
+        // until its table is installed. A store shut down meanwhile replays the log.
+        if (!flushMemTable(*imm))
+        {
+            std::cerr << "Failed to flush the immutable memtable; retrying" << std::endl;
+            std::unique_lock<std::mutex> lock(flush_mutex);
+            flush_cv.wait_for(lock, std::chrono::seconds(1), [this]
+                              { return shutting_down.load(); });
+            if (shutting_down)
+            {
+                return;
+            }
+            continue;
+        }
+
+        {
+            std::unique_lock<std::shared_mutex> lock(memtable_mutex);
+            immutable_memtable.reset();
+        }
+
+        wal->clearTemp();
+
+        {
+            std::lock_guard<std::mutex> lock(flush_mutex);
+            flush_pending = false;
+        }
+        flush_cv.notify_all();
+
+        maybeScheduleCompaction();
+    }
+}
+
+bool KVStore::flushMemTable(const MemTable &mem)
+{
+    if (mem.empty())
+    {
+        return true;
+    }
+
+    int newFileId = next_file_id++;
+    std::string new_filename = generateSSTableFilename(0, newFileId);
+
+    BloomFilter bf(std::max<size_t>(mem.size(), 1), bloomBitsPerKey(0));
+    TableProperties props;
+    std::vector<IndexEntry> index;
+    if (!SSTable::flush(mem, snapshots.sequences(), new_filename, bf, tableOptions(0), index, &props))
+    {
+        std::error_code ec;
+        fs::remove(new_filename, ec);
+        return false;
+    }
+
+    if (index.empty() && props.num_range_deletions == 0)
+    {
+        fs::remove(new_filename);
+        return true;
+    }
+
+    long file_size = fs::file_size(fs::path(new_filename));
+    VersionEdit edit;
+    edit.addFile(0, newTableHandle(new SSTableMetadata{new_filename, index, bf, newFileId, props.min_key, props.max_key, file_size, props.format_version, mem.rangeTombstones(), props.largest_sequence},
+                                   table_cache.get()));
+
+    std::lock_guard<std::mutex> lock(levels_mutex);
+    if (!installVersion(edit))
+    {
+        std::cerr << "Failed to record flushed SSTable " << new_filename << std::endl;
+        fs::remove(new_filename);
+        return false;
+    }
+    return true;
+}
+
+bool KVStore::searchTable(const SSTableMetadata &sst, const std::string &key, uint64_t snapshot, std::string &value, ValueType &type, uint64_t &sequence) const
+{
+    if (auto table = table_cache->get(sst.fileId, sst.filename))
+    {
+        return SSTable::search(*table, sst.index, key, value, type, snapshot, &sequence);
+    }
+
+    // The file could not be mapped; fall back to reading the block through the block cache
+    return SSTable::search(sst.filename, sst.index, key, value, type, block_cache.get(), sst.fileId, sst.formatVersion, options.verify_checksums, snapshot, &sequence);
+}
+
+bool KVStore::lookupTable(const SSTableMetadata &sst, const std::string &key, uint64_t snapshot, std::optional<std::string> &result) const
+{
+    std::string value;
+    ValueType type;
+    uint64_t sequence;
+
+    // A table's tombstones hide only the versions in it that are older than them
+    if (sst.bloomFilter.contains(key) && searchTable(sst, key, snapshot, value, type, sequence))
+    {
+        bool hidden = !sst.rangeTombstones.empty() && hiddenFrom(sst.rangeTombstones, key, sequence) <= snapshot;
+        result = type == ValueType::Value && !hidden ? std::make_optional(std::move(value)) : std::nullopt;
+        return true;
+    }
+
+    if (coveredByAny(sst.rangeTombstones, key, snapshot))
+    {
+        result = std::nullopt;
+        return true;
+    }
+
+    return false;
+}
+
+void KVStore::searchTableMany(const SSTableMetadata &sst, const std::string_view *keys, size_t count, uint64_t snapshot, bool *found, std::string *values, ValueType *types, uint64_t *sequences) const
+{
+    std::unique_ptr<bool[]> may_contain(new bool[count]);
+    sst.bloomFilter.containsMany(keys, count, may_contain.get());
+
+    std::vector<std::string_view> candidates;
+    std::vector<size_t> positions;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (may_contain[i])
+        {
+            candidates.push_back(keys[i]);
+            positions.push_back(i);
+        }
+    }
+
+    if (candidates.empty())
+    {
+        return;
+    }
+
+    std::unique_ptr<bool[]> candidate_found(new bool[candidates.size()]());
+    std::vector<std::string> candidate_values(candidates.size());
+    std::vector<ValueType> candidate_types(candidates.size());
+    std::vector<uint64_t> candidate_sequences(candidates.size());
+
+    if (auto table = table_cache->get(sst.fileId, sst.filename))
+    {
+        SSTable::searchMany(*table, sst.index, candidates.data(), candidates.size(), candidate_found.get(), candidate_values.data(), candidate_types.data(),
+                            snapshot, candidate_sequences.data());
+    }
+    else
+    {
+        for (size_t i = 0; i < candidates.size(); i++)
+        {
+            candidate_found[i] = SSTable::search(sst.filename, sst.index, std::string(candidates[i]), candidate_values[i], candidate_types[i], block_cache.get(), sst.fileId, sst.formatVersion, options.verify_checksums,
+                                                 snapshot, &candidate_sequences[i]);
+        }
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        if (candidate_found[i])
+        {
+            found[positions[i]] = true;
+            values[positions[i]] = std::move(candidate_values[i]);
+            types[positions[i]] = candidate_types[i];
+            sequences[positions[i]] = candidate_sequences[i];
+        }
+    }
+}
+
+std::vector<std::optional<std::string>> KVStore::multiGet(const std::vector<std::string> &keys, const ReadOptions &read_options) const
+{
+    std::vector<std::optional<std::string>> results(keys.size());
+    ReadView view = acquireReadView(read_options);
+    uint64_t snapshot = view.sequence;
+    const MemTable *mem = view.mem.get();
+    const MemTable *imm = view.imm.get();
+
+    // Indices of unresolved keys, kept in key order
+    std::vector<size_t> pending(keys.size());
+    std::iota(pending.begin(), pending.end(), 0);
+    std::sort(pending.begin(), pending.end(), [&keys](size_t a, size_t b)
+              { return keys[a] < keys[b]; });
+
+    std::vector<bool> resolved(keys.size(), false);
+
+    for (size_t index : pending)
+    {
+        std::string value;
+        ValueType type;
+        if (mem->get(keys[index], snapshot, value, type) || (imm && imm->get(keys[index], snapshot, value, type)))
+        {
+            resolved[index] = true;
+            if (type == ValueType::Value)
+            {
+                results[index] = std::move(value);
+            }
+        }
+    }
+
+    auto dropResolved = [&]()
+    {
+        pending.erase(std::remove_if(pending.begin(), pending.end(), [&resolved](size_t index)
+                                     { return resolved[index]; }),
+                      pending.end());
+    };
+    dropResolved();
+
+    std::vector<std::string_view> batch_keys;
+    std::unique_ptr<bool[]> found(new bool[keys.size()]);
+    std::vector<std::string> values(keys.size());
+    std::vector<ValueType> types(keys.size());
+    std::vector<uint64_t> sequences(keys.size());
+
+    // Probes the pending keys inside the table's key range in one batch
+    auto probe = [&](const SSTableMetadata &sst)
+    {
+        auto first = std::lower_bound(pending.begin(), pending.end(), sst.minKey, [&keys](size_t index, const std::string &k)
+                                      { return keys[index] < k; });
+        auto last = std::upper_bound(first, pending.end(), sst.maxKey, [&keys](const std::string &k, size_t index)
+                                     { return k < keys[index]; });
+        size_t count = last - first;
+        if (count == 0)
+        {
+            return;
+        }
+
+        batch_keys.clear();
+        for (auto it = first; it != last; ++it)
+        {
+            batch_keys.push_back(keys[*it]);
+        }
+        std::fill(found.get(), found.get() + count, false);
+
+        searchTableMany(sst, batch_keys.data(), count, snapshot, found.get(), values.data(), types.data(), sequences.data());
+
+        bool any = false;
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t index = first[i];
+            if (found[i])
+            {
+                resolved[index] = true;
+                bool hidden = !sst.rangeTombstones.empty() && hiddenFrom(sst.rangeTombstones, batch_keys[i], sequences[i]) <= snapshot;
+                if (types[i] == ValueType::Value && !hidden)
+                {
+                    results[index] = std::move(values[i]);
+                }
+                any = true;
+            }
+            else if (coveredByAny(sst.rangeTombstones, batch_keys[i], snapshot))
+            {
+                resolved[index] = true;
+                any = true;
+            }
+        }
+        if (any)
+        {
+            dropResolved();
+        }
+    };
+
+    const Version *version = view.version.get();
+    const auto &level0 = version->files(0);
+
+    for (auto it = level0.rbegin(); it != level0.rend() && !pending.empty(); ++it)
+    {
+        probe(**it);
+    }
+
+    for (size_t i = 1; i < version->numLevels() && !pending.empty(); ++i)
+    {
+        for (const auto &sst : version->files(i))
+        {
+            probe(*sst);
+        }
+    }
+
+    return results;
+}
+
+std::optional<std::string> KVStore::get(const std::string &key, const ReadOptions &read_options) const
+{
+    ReadView view = acquireReadView(read_options);
+    uint64_t snapshot = view.sequence;
+
+    std::string value;
+    ValueType type;
+    if (view.mem->get(key, snapshot, value, type) || (view.imm && view.imm->get(key, snapshot, value, type)))
+    {
+        return type == ValueType::Value ? std::make_optional(std::move(value)) : std::nullopt;
+    }
+
+    // The version keeps every table it lists on disk, so no lock is held while searching
+    const Version *version = view.version.get();
+    std::optional<std::string> result;
+
+    const auto &level0 = version->files(0);
+    for (auto it = level0.rbegin(); it != level0.rend(); ++it)
+    {
+        const SSTableMetadata &sst = **it;
+        if (!sst.minKey.empty() && !sst.maxKey.empty() && (key < sst.minKey || key > sst.maxKey))
+        {
+            continue;
+        }
+
+        if (lookupTable(sst, key, snapshot, result))
+        {
+            return result;
+        }
+    }
+
+    for (size_t i = 1; i < version->numLevels(); ++i)
+    {
+        const auto &level_files = version->files(i);
+        if (level_files.empty())
+        {
+            continue;
+        }
+
+        auto it = std::lower_bound(level_files.begin(), level_files.end(), key,
+                                   [](const TableHandle &meta, const std::string &val)
+                                   {
+                                       return meta->maxKey < val;
+                                   });
+
+        // A range tombstone's exclusive end can make a file's maxKey equal the next file's minKey
+        for (; it != level_files.end() && key >= (*it)->minKey; ++it)
+        {
+            if (lookupTable(**it, key, snapshot, result))
+            {
+                return result;
+            }
+        }
+    }
+
+    return std::nullopt;
+}
+
+// Everything an iterator reads from, pinned for its lifetime. The version keeps
+// the tables' metadata (which table iterators point into) and files alive.
+struct KVStore::Iterator::State
+{
+    struct Table
+    {
+        std::shared_ptr<TableReader> reader;
+        const SSTableMetadata *sst;
+    };
+
+    std::shared_ptr<MemTable> mem;
+    std::shared_ptr<MemTable> imm;
+    std::shared_ptr<const Version> version;
+    std::deque<std::vector<Table>> levels;
+    // A table of the version could not be opened and is left out
+    bool missing_table = false;
+};
+
+std::unique_ptr<KVStore::Iterator> KVStore::newIterator(const ReadOptions &read_options) const
+{
+    auto state = std::make_unique<Iterator::State>();
+    std::vector<std::unique_ptr<InternalIterator>> children;
+    // Range tombstones of each child, newest child first
+    std::vector<std::vector<RangeTombstone>> child_tombstones;
+    ReadView view = acquireReadView(read_options);
+    uint64_t snapshot = view.sequence;
+    state->mem = std::move(view.mem);
+    state->imm = std::move(view.imm);
+    state->version = std::move(view.version);
+
+    children.push_back(std::make_unique<MemTableIterator>(state->mem.get(), snapshot));
+    child_tombstones.push_back(state->mem->rangeTombstones());
+    if (state->imm)
+    {
+        children.push_back(std::make_unique<MemTableIterator>(state->imm.get(), snapshot));
+        child_tombstones.push_back(state->imm->rangeTombstones());
+    }
+
+    const Version &version = *state->version;
+
+    const auto &level0 = version.files(0);
+    for (auto it = level0.rbegin(); it != level0.rend(); ++it)
+    {
+        const SSTableMetadata &sst = **it;
+        auto reader = table_cache->get(sst.fileId, sst.filename);
+        if (!reader)
+        {
+            std::cerr << "Failed to open SSTable for iteration: " << sst.filename << std::endl;
+            state->missing_table = true;
+            continue;
+        }
+
+        children.push_back(std::make_unique<TableIterator>(reader, &sst.index, snapshot, &sst.rangeTombstones));
+        child_tombstones.push_back(sst.rangeTombstones);
+    }
+
+    for (size_t i = 1; i < version.numLevels(); ++i)
+    {
+        std::vector<Iterator::State::Table> &files = state->levels.emplace_back();
+        std::vector<std::string> max_keys;
+        std::vector<RangeTombstone> tombstones;
+
+        for (const auto &sst : version.files(i))
+        {
+            auto reader = table_cache->get(sst->fileId, sst->filename);
+            if (!reader)
+            {
+                std::cerr << "Failed to open SSTable for iteration: " << sst->filename << std::endl;
+                state->missing_table = true;
+                continue;
+            }
+
+            files.push_back({reader, sst.get()});
+            max_keys.push_back(sst->maxKey);
+            tombstones.insert(tombstones.end(), sst->rangeTombstones.begin(), sst->rangeTombstones.end());
+        }
+
+        if (files.empty())
+        {
+            continue;
+        }
+
+        children.push_back(std::make_unique<LevelIterator>(std::move(max_keys), [&files, snapshot](size_t file)
+                                                           { return std::make_unique<TableIterator>(files[file].reader, &files[file].sst->index, snapshot, &files[file].sst->rangeTombstones); }));
+        child_tombstones.push_back(std::move(tombstones));
+    }
+
+    // Each child is hidden behind the range tombstones of every newer child that the snapshot sees
+    std::vector<RangeTombstone> newer;
+    for (size_t i = 0; i < children.size(); i++)
+    {
+        if (!newer.empty())
+        {
+            children[i] = std::make_unique<RangeTombstoneFilter>(std::move(children[i]), newer);
+        }
+        std::copy_if(child_tombstones[i].begin(), child_tombstones[i].end(), std::back_inserter(newer), [snapshot](const RangeTombstone &t)
+                     { return t.sequence <= snapshot; });
+    }
+
+    auto merged = std::make_unique<MergingIterator>(std::move(children));
+    std::unique_ptr<Iterator> iter(new Iterator(std::move(state), read_options));
+    iter->merged = std::move(merged);
+    return iter;
+}
+
+KVStore::Iterator::Iterator(std::unique_ptr<State> state, const ReadOptions &read_options)
+    : state(std::move(state)), bounds(read_options)
+{
+}
+
+KVStore::Iterator::~Iterator() = default;
+
+bool KVStore::Iterator::valid() const
+{
+    if (!merged->valid())
+    {
+        return false;
+    }
+
+    std::string_view key = merged->key();
+    return !(bounds.upper_bound && key >= *bounds.upper_bound) && !(bounds.lower_bound && key < *bounds.lower_bound);
+}
+
+void KVStore::Iterator::seekToFirst()
+{
+    if (bounds.lower_bound)
+    {
+        merged->seek(*bounds.lower_bound);
+    }
+    else
+    {
+        merged->seekToFirst();
+    }
+    skipDeletedForward();
+}
+
+void KVStore::Iterator::seekToLast()
+{
+    if (bounds.upper_bound)
+    {
+        // Last key before the exclusive upper bound
+        merged->seek(*bounds.upper_bound);
+        if (merged->valid())
+        {
+            merged->prev();
+        }
+        else
+        {
+            merged->seekToLast();
+        }
+    }
+    else
     {
-        memtable->put(key, value);
+        merged->seekToLast();
     }
+    skipDeletedBackward();
+}
 
-    if (!history.empty())
+void KVStore::Iterator::seek(const std::string &target)
+{
+    if (bounds.lower_bound && target < *bounds.lower_bound)
     {
-        std::cout << "Loaded " << history.size() << " entries from WAL" << std::endl;
+        merged->seek(*bounds.lower_bound);
     }
     else
     {
-        std::cout << "No history found in WAL" << std::endl;
+        merged->seek(target);
     }
-
-    loadSSTables();
+    skipDeletedForward();
 }
 
-void KVStore::loadSSTables()
+void KVStore::Iterator::next()
 {
-    levels.clear();
-    levels.push_back({});
-
-    int max_level = 0;
-    std::vector<std::pair<int, SSTableMetadata>> candidates;
-
-    for (const auto &entry : fs::directory_iterator(data_directory))
-    {
-        if (entry.path().extension() == ".sst")
-        {
-            if (!fs::exists(entry.path()))
-            {
-                continue;
-            }
-
-            std::string filename = entry.path().filename().string();
-
-            int level = 0;
-            int fileId = 0;
-
-            if (filename.find("level_") == 0)
-            {
-                if (sscanf(filename.c_str(), "level_%d_%d.sst", &level, &fileId) != 2)
-                {
-                    continue;
-                }
-            }
+    merged->next();
+    skipDeletedForward();
+}
 
-            std::string full_path = fs::absolute(entry.path()).lexically_normal().string();
-            BloomFilter bf(1000, 7);
-            std::vector<IndexEntry> index = SSTable::loadIndex(full_path, bf);
+void KVStore::Iterator::prev()
+{
+    merged->prev();
+    skipDeletedBackward();
+}
 
-            std::string min_key = "";
-            std::string max_key = "";
-            if (!index.empty())
-            {
-                min_key = index.front().key;
-                max_key = index.back().key;
-            }
-            long file_size = fs::file_size(entry.path());
+std::string_view KVStore::Iterator::key() const
+{
+    return merged->key();
+}
 
-            SSTableMetadata metadata = {full_path, index, bf, fileId, min_key, max_key, file_size};
+std::string_view KVStore::Iterator::value() const
+{
+    return merged->value();
+}
 
-            candidates.push_back({level, metadata});
-            max_level = std::max(max_level, level);
-        }
-    }
+bool KVStore::Iterator::status() const
+{
+    return !state->missing_table && merged->ok();
+}
 
-    while (levels.size() <= max_level)
+void KVStore::Iterator::skipDeletedForward()
+{
+    while (merged->valid() && merged->type() == ValueType::Deletion)
     {
-        levels.push_back({});
+        if (bounds.upper_bound && merged->key() >= *bounds.upper_bound)
+        {
+            return;
+        }
+        merged->next();
     }
+}
 
-    for (auto &[level, metadata] : candidates)
+void KVStore::Iterator::skipDeletedBackward()
+{
+    while (merged->valid() && merged->type() == ValueType::Deletion)
     {
-        levels[level].push_back(metadata);
+        if (bounds.lower_bound && merged->key() < *bounds.lower_bound)
+        {
+            return;
+        }
+        merged->prev();
     }
+}
 
-    for (auto &level : levels)
-    {
-        std::sort(level.begin(), level.end(),
-                  [](const SSTableMetadata &a, const SSTableMetadata &b)
-                  {
-                      return a.fileId < b.fileId;
-                  });
-    }
+BlockCache::Stats KVStore::blockCacheStats() const
+{
+    return block_cache ? block_cache->stats() : BlockCache::Stats();
+}
 
-    std::cout << "Loaded " << candidates.size() << " SSTables across " << (max_level + 1) << " levels" << std::endl;
+StartupStats KVStore::startupStats() const
+{
+    return startup_stats;
 }
 
-std::string KVStore::generateSSTableFilename(int level, int file_id)
+CompressionStats::Snapshot KVStore::compressionStats() const
 {
-    std::ostringstream oss;
-    oss << data_directory << "/level_" << level << "_" << file_id << ".sst";
-    std::string path = oss.str();
-    return fs::absolute(path).lexically_normal().string();
+    return compression_stats.snapshot();
 }
 
-void KVStore::put(const std::string &key, const std::string &value)
+void KVStore::remove(const std::string &key)
 {
-    bool success = wal->write(key, value);
+    writeEntry(ValueType::Deletion, key, "");
+}
 
-    if (!success)
+void KVStore::deleteRange(const std::string &begin, const std::string &end)
+{
+    if (begin >= end)
     {
-        std::cerr << "Failed to write to WAL" << std::endl;
         return;
     }
+    writeEntry(ValueType::RangeDeletion, begin, end);
+}
 
-    memtable->put(key, value);
-
-    if (memtable->size() >= 64000)
+bool KVStore::write(const WriteBatch &batch)
+{
+    if (batch.count() == 0)
     {
-        wal->rotate();
-
-        std::map<std::string, std::string> data = memtable->flush();
-
-        std::string new_filename;
-        int newFileId;
-
-        {
-            std::unique_lock<std::shared_mutex> lock(levels_mutex);
-
-            if (levels.empty())
-            {
-                levels.push_back({});
-            }
+        return true;
+    }
 
-            newFileId = levels[0].empty() ? 1 : (std::max_element(levels[0].begin(), levels[0].end(), [](const SSTableMetadata &a, const SSTableMetadata &b)
-                                                                  { return a.fileId < b.fileId; })
-                                                     ->fileId +
-                                                 1);
+    bool success;
+    bool memtable_full;
+    uint64_t first;
 
-            new_filename = generateSSTableFilename(0, newFileId);
-        }
+    {
+        std::shared_lock<std::shared_mutex> lock(memtable_mutex);
 
-        if (data.empty()) {
-            return;
-        }
-        BloomFilter bf(data.size(), 7);
-        std::vector<IndexEntry> index = SSTable::flush(data, new_filename, bf);
-        long file_size = fs::file_size(fs::path(new_filename));
-        SSTableMetadata metadata = {new_filename, index, bf, newFileId, data.begin()->first, data.rbegin()->first, file_size};
+        // Operations are numbered consecutively in batch order, as replay numbers them
+        first = next_sequence.fetch_add(batch.count());
+        success = wal->write(batch, first);
 
+        if (success)
         {
-            std::unique_lock<std::shared_mutex> lock(levels_mutex);
-            levels[0].push_back(metadata);
+            MemTable &mem = *memtable;
+            uint64_t sequence = first;
+            WriteBatch::iterate(batch.contents(), [&mem, &sequence](WriteBatch::OpType op, std::string_view key, std::string_view value)
+                                {
+                switch (op)
+                {
+                case WriteBatch::OpType::Put:
+                    mem.put(key, value, sequence);
+                    break;
+                case WriteBatch::OpType::Delete:
+                    mem.remove(key, sequence);
+                    break;
+                case WriteBatch::OpType::DeleteRange:
+                    applyEntry(mem, ValueType::RangeDeletion, key, value, sequence);
+                    break;
+                }
+                sequence++; });
         }
+        memtable_full = memtableFull(*memtable);
+    }
 
-        wal->clearTemp();
+    publishSequence(first, first + batch.count() - 1);
+
+    if (!success)
+    {
+        std::cerr << "Failed to write batch to WAL" << std::endl;
+        return false;
+    }
 
-        checkCompactionStatus();
+    if (memtable_full)
+    {
+        makeRoomForWrite();
     }
+
+    return true;
 }
 
-std::optional<std::string> KVStore::get(const std::string &key) const
+std::vector<std::string> KVStore::subcompactionBoundaries(const std::vector<std::pair<TableHandle, int>> &inputs) const
 {
-    auto result = memtable->get(key);
-    if (result)
+    uint64_t input_bytes = 0;
+    for (const auto &[sst, input_level] : inputs)
     {
-        return *result == "TOMBSTONE" ? std::nullopt : result;
+        input_bytes += sst->fileSize;
     }
 
-    std::shared_lock<std::shared_mutex> lock(levels_mutex);
+    // Each slice gets at least one output table's worth of input
+    size_t slices = std::min<uint64_t>(std::max(options.max_subcompactions, 1), input_bytes / std::max<size_t>(options.target_file_size, 1));
+    if (slices <= 1)
+    {
+        return {};
+    }
 
-    if (!levels.empty() && !levels[0].empty())
+    // Every data block ends at a key its table's sparse index records; cutting at
+    // those keys in order, weighted by block size, splits the input bytes evenly
+    std::vector<std::pair<std::string_view, long>> block_ends;
+    long total = 0;
+    for (const auto &[sst, input_level] : inputs)
     {
-        for (auto it = levels[0].rbegin(); it != levels[0].rend(); ++it)
+        for (const auto &entry : sst->index)
         {
-            if (!it->minKey.empty() && !it->maxKey.empty() && (key < it->minKey || key > it->maxKey))
-            {
-                continue;
-            }
-
-            if (!it->bloomFilter.contains(key))
-            {
-                continue;
-            }
-
-            std::string value;
-            if (SSTable::search(it->filename, it->index, key, value))
+            if (!entry.key.empty())
             {
-                return value == "TOMBSTONE" ? std::nullopt : std::make_optional(value);
+                block_ends.push_back({entry.key, entry.size});
+                total += entry.size;
             }
         }
     }
+    std::sort(block_ends.begin(), block_ends.end());
 
-    for (size_t i = 1; i < levels.size(); ++i)
+    std::vector<std::string> boundaries;
+    long covered = 0;
+    for (const auto &[key, size] : block_ends)
     {
-        const auto &level_files = levels[i];
-        if (level_files.empty())
+        if (boundaries.size() + 1 >= slices)
         {
-            continue;
+            break;
         }
-
-        auto it = std::lower_bound(level_files.begin(), level_files.end(), key,
-                                   [](const SSTableMetadata &meta, const std::string &val)
-                                   {
-                                       return meta.maxKey < val;
-                                   });
-
-        if (it != level_files.end() && key >= it->minKey && key <= it->maxKey)
+        covered += size;
+        if (covered * slices >= total * (boundaries.size() + 1) && (boundaries.empty() || key > boundaries.back()))
         {
-            if (it->bloomFilter.contains(key))
-            {
-                std::string value;
-                if (SSTable::search(it->filename, it->index, key, value))
-                {
-                    return value == "TOMBSTONE" ? std::nullopt : std::make_optional(value);
-                }
-            }
+            boundaries.push_back(std::string(key));
         }
     }
-
-    return std::nullopt;
+    return boundaries;
 }
 
-void KVStore::remove(const std::string &key)
-{
-    if (!wal->write(key, "TOMBSTONE")) {
-        std::cerr << "Failed to write tombstone to WAL" << std::endl;
-        return;
-    }
-    memtable->put(key, "TOMBSTONE");
-};
-
-void KVStore::checkCompactionStatus()
+void KVStore::maybeScheduleCompaction()
 {
-    int levelToCompact = -1;
-    size_t fileCount = 0;
+    std::lock_guard<std::mutex> lock(levels_mutex);
 
+    if (shutting_down)
     {
-        std::shared_lock<std::shared_mutex> lock(levels_mutex);
-
-        if (levels.size() > 0 && levels[0].size() > 4)
-        {
-            if (active_compactions.find(0) == active_compactions.end())
-            {
-                levelToCompact = 0;
-                fileCount = levels[0].size();
-            }
-        }
-        else
-        {
-            for (size_t level = 1; level < levels.size(); ++level)
-            {
-                if (levels[level].size() > 10)
-                {
-                    if (active_compactions.find(level) == active_compactions.end())
-                    {
-                        levelToCompact = level;
-                        fileCount = levels[level].size();
-                        break;
-                    }
-                }
-            }
-        }
+        return;
     }
 
-    if (levelToCompact >= 0)
+    // Requeued from scratch, so a level that no longer needs compaction drops out
+    std::shared_ptr<const Version> version = currentVersion();
+    compaction_queue.clear();
+    for (int level : compaction_picker->levelsToCompact(*version))
     {
-        compact(levelToCompact);
+        compaction_queue.push_back(level);
     }
+
+    dispatchCompactions();
 }
 
-void KVStore::compact(int level)
+void KVStore::dispatchCompactions()
 {
+    // Caller holds levels_mutex
+    std::shared_ptr<const Version> version = currentVersion();
+    for (auto it = compaction_queue.begin(); it != compaction_queue.end();)
     {
-        std::unique_lock<std::shared_mutex> lock(levels_mutex);
-        if (active_compactions.find(level) != active_compactions.end())
+        int level = *it;
+
+        if (active_compactions.count(level) || active_compactions.count(level + 1))
         {
-            return;
+            ++it;
+            continue;
         }
-        active_compactions.insert(level);
-    }
 
-    std::vector<SSTableMetadata> toCompact;
-    std::vector<SSTableMetadata> nextLevelOverlapping;
-    bool needNewLevel = false;
-    int startFileId = 1;
+        Compaction compaction;
+        if (!compaction_picker->pickCompaction(*version, level, compaction))
+        {
+            it = compaction_queue.erase(it);
+            continue;
+        }
 
-    {
-        std::shared_lock<std::shared_mutex> lock(levels_mutex);
-        if (level >= levels.size() || levels[level].empty())
+        // A table a compaction could not read would only fail it again
+        bool unreadable = std::any_of(compaction.inputs.begin(), compaction.inputs.end(), [this](const auto &input)
+                                      { return uncompactable_files.count(input.first->fileId) > 0; });
+        if (unreadable)
         {
-            lock.unlock();
-            std::unique_lock<std::shared_mutex> writeLock(levels_mutex);
-            active_compactions.erase(level);
-            return;
+            it = compaction_queue.erase(it);
+            continue;
         }
 
-        if (level + 1 >= levels.size())
+        // The compaction owns every level from its inputs down to its output
+        bool busy = false;
+        for (int i = compaction.level; i <= compaction.output_level; ++i)
         {
-            needNewLevel = true;
+            busy = busy || active_compactions.count(i);
         }
-        else
+        if (busy)
         {
-            if (!levels[level + 1].empty())
-            {
-                startFileId = std::max_element(levels[level + 1].begin(), levels[level + 1].end(),
-                                               [](const SSTableMetadata &a, const SSTableMetadata &b)
-                                               {
-                                                   return a.fileId < b.fileId;
-                                               })
-                                  ->fileId +
-                              1;
-            }
+            ++it;
+            continue;
         }
 
-        toCompact = levels[level];
-
-        if (level + 1 < levels.size() && !levels[level + 1].empty() && !toCompact.empty())
+        for (int i = compaction.level; i <= compaction.output_level; ++i)
         {
-            std::string minKey = toCompact[0].minKey;
-            std::string maxKey = toCompact[0].maxKey;
+            active_compactions.insert(i);
+        }
+        it = compaction_queue.erase(it);
 
-            for (const auto &sst : toCompact)
-            {
-                if (sst.minKey < minKey)
-                    minKey = sst.minKey;
-                if (sst.maxKey > maxKey)
-                    maxKey = sst.maxKey;
-            }
+        compaction_pool->submit([this, compaction]
+                                { runCompaction(compaction); });
+    }
+}
 
-            for (const auto &sst : levels[level + 1])
-            {
-                bool overlaps = !(sst.maxKey < minKey || sst.minKey > maxKey);
-                if (overlaps)
-                {
-                    nextLevelOverlapping.push_back(sst);
-                }
-            }
+void KVStore::runCompaction(const Compaction &compaction)
+{
+    // The picker would choose the same inputs straight away, so a failure that may
+    // clear up (a full disk, say) keeps the levels for a pause before the retry
+    if (!compact(compaction))
+    {
+        std::unique_lock<std::mutex> lock(flush_mutex);
+        flush_cv.wait_for(lock, std::chrono::seconds(1), [this]
+                          { return shutting_down.load(); });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(levels_mutex);
+        for (int i = compaction.level; i <= compaction.output_level; ++i)
+        {
+            active_compactions.erase(i);
         }
     }
 
+    // The output level may now need compaction too
+    maybeScheduleCompaction();
+}
+
+bool KVStore::compact(const Compaction &compaction)
+{
+    // No other compaction touches the levels this one owns and flushes only add to
+    // level 0, so the inputs stay in the current version until it installs its output
+    int level = compaction.level;
+    int outputLevel = compaction.output_level;
+    bool isBottomLevel = compaction.bottommost;
+    const std::vector<std::pair<TableHandle, int>> &inputTables = compaction.inputs;
+
     struct IteratorWrapper
     {
-        std::unique_ptr<SSTableIterator> iter;
+        SSTableIterator *iter;
         int fileId;
         int level;
 
+        // Versions of a key come out newest first: by sequence, then (for tables without
+        // sequence numbers) by level and file id
         bool operator>(const IteratorWrapper &other) const
         {
             if (iter->key() != other.iter->key())
             {
                 return iter->key() > other.iter->key();
             }
+            if (iter->sequence() != other.iter->sequence())
+            {
+                return iter->sequence() < other.iter->sequence();
+            }
             if (level != other.level)
             {
                 return level > other.level;
@@ -386,176 +1475,319 @@ void KVStore::compact(int level)
         }
     };
 
-    std::priority_queue<IteratorWrapper, std::vector<IteratorWrapper>,
-                        std::greater<IteratorWrapper>>
-        minHeap;
+    // A range tombstone hides the versions older than it; one without a sequence
+    // number hides every entry of an older input: deeper levels, or lower file
+    // ids within the same level
+    struct InputTombstone
+    {
+        RangeTombstone range;
+        int fileId;
+        int level;
+    };
 
-    for (const auto &sst : toCompact)
+    std::vector<InputTombstone> inputTombstones;
+    for (const auto &[sst, input_level] : inputTables)
     {
-        auto iter = std::make_unique<SSTableIterator>(sst.filename, sst.fileId);
-        if (iter->hasNext())
+        for (const auto &t : sst->rangeTombstones)
         {
-            minHeap.push({std::move(iter), sst.fileId, level});
+            inputTombstones.push_back({t, sst->fileId, input_level});
         }
     }
 
-    for (const auto &sst : nextLevelOverlapping)
+    // Snapshot from which the version is hidden by a tombstone
+    auto hiddenFromInputs = [&inputTombstones](const IteratorWrapper &source, std::string_view key, uint64_t sequence)
     {
-        auto iter = std::make_unique<SSTableIterator>(sst.filename, sst.fileId);
-        if (iter->hasNext())
+        uint64_t from = MAX_SEQUENCE_NUMBER + 1;
+        for (const auto &t : inputTombstones)
         {
-            minHeap.push({std::move(iter), sst.fileId, level + 1});
+            bool newer = t.level < source.level || (t.level == source.level && t.fileId > source.fileId);
+            if ((newer || t.range.sequence > sequence) && t.range.sequence < from && t.range.covers(key))
+            {
+                from = t.range.sequence;
+            }
         }
-    }
-
-    bool isBottomLevel = (level + 1 >= levels.size() - 1);
-
-    const size_t MAX_SSTABLE_SIZE = 2 * 1024 * 1024;
-    std::vector<std::pair<std::string, std::string>> currentBatch;
-    size_t currentBatchSize = 0;
+        return from;
+    };
 
-    int newFileId = startFileId;
-    std::vector<SSTableMetadata> newSegmentFiles;
+    // Versions are kept while a live snapshot can read them
+    std::vector<uint64_t> snapshotSequences = snapshots.sequences();
 
-    std::string lastKey = "";
-    bool isFirst = true;
+    // Large compactions are split into key-range slices that are merged in parallel,
+    // each into its own output tables. Slice i covers [boundaries[i - 1], boundaries[i]);
+    // the first is open below and the last above.
+    std::vector<std::string> boundaries = subcompactionBoundaries(inputTables);
+    size_t numSlices = boundaries.size() + 1;
 
-    auto flushBatch = [&]()
+    struct SliceResult
     {
-        if (currentBatch.empty())
-            return;
-
-        BloomFilter bf(currentBatch.size(), 7);
-        std::string filename = generateSSTableFilename(level + 1, newFileId);
-        std::vector<IndexEntry> index = SSTable::flush(currentBatch, filename, bf);
-
-        SSTableMetadata metadata = {
-            filename,
-            index,
-            bf,
-            newFileId,
-            currentBatch.front().first,
-            currentBatch.back().first,
-            static_cast<long>(fs::file_size(filename))};
-
-        newSegmentFiles.push_back(metadata);
-        newFileId++;
-        currentBatch.clear();
-        currentBatchSize = 0;
+        std::vector<TableHandle> outputs;
+        // The input table that failed to read, or -1
+        int corruptFileId = -1;
+        // An output table could not be written; the merge stopped there
+        bool writeFailed = false;
     };
+    std::vector<SliceResult> results(numSlices);
 
-    while (!minHeap.empty())
+    auto compactSlice = [&](size_t slice)
     {
-        IteratorWrapper top = std::move(const_cast<IteratorWrapper &>(minHeap.top()));
-        minHeap.pop();
+        const std::string *sliceBegin = slice > 0 ? &boundaries[slice - 1] : nullptr;
+        const std::string *sliceEnd = slice < boundaries.size() ? &boundaries[slice] : nullptr;
+        SliceResult &result = results[slice];
 
-        std::string key = top.iter->key();
-        std::string value = top.iter->value();
+        std::priority_queue<IteratorWrapper, std::vector<IteratorWrapper>,
+                            std::greater<IteratorWrapper>>
+            minHeap;
+        // Owns the iterators the heap points at, so each can be checked once the merge ends
+        std::vector<std::unique_ptr<SSTableIterator>> inputs;
 
-        if (!isFirst && key == lastKey)
+        for (const auto &[sst, input_level] : inputTables)
         {
-            top.iter->next();
-            if (top.iter->hasNext())
+            inputs.push_back(std::make_unique<SSTableIterator>(table_cache->get(sst->fileId, sst->filename), sst->fileId));
+            if (sliceBegin)
             {
-                minHeap.push(std::move(top));
+                inputs.back()->seek(*sliceBegin);
+            }
+            if (inputs.back()->hasNext() && (!sliceEnd || inputs.back()->key() < *sliceEnd))
+            {
+                minHeap.push({inputs.back().get(), sst->fileId, input_level});
             }
-            continue;
         }
 
-        if (value == "TOMBSTONE" && isBottomLevel)
-        {
-            lastKey = key;
-            isFirst = false;
+        // At the bottom level a tombstone is only written if it hides a version kept for a snapshot
+        std::vector<bool> tombstoneNeeded(inputTombstones.size(), !isBottomLevel);
+
+        std::vector<TableEntry> currentBatch;
+        size_t currentBatchSize = 0;
 
-            top.iter->next();
-            if (top.iter->hasNext())
+        // Start of the key range owned by the next output file
+        std::string rangeStart = sliceBegin ? *sliceBegin : "";
+
+        // Tombstones still shadow deeper levels (at the bottom, only versions kept for
+        // snapshots), so each output keeps the part of them inside its own key range
+        auto clipTombstones = [&](bool last)
+        {
+            std::vector<RangeTombstone> clipped;
+            bool unbounded = last && !sliceEnd;
+            std::string rangeEnd = !last ? currentBatch.back().key + '\0' : sliceEnd ? *sliceEnd : "";
+            for (size_t i = 0; i < inputTombstones.size(); i++)
             {
-                minHeap.push(std::move(top));
+                const RangeTombstone &t = inputTombstones[i].range;
+                if (!tombstoneNeeded[i])
+                {
+                    continue;
+                }
+
+                RangeTombstone c{std::max(t.begin, rangeStart), unbounded ? t.end : std::min(t.end, rangeEnd), t.sequence};
+                if (c.begin < c.end)
+                {
+                    clipped.push_back(std::move(c));
+                }
             }
-            continue;
-        }
+            rangeStart = rangeEnd;
+            return clipped;
+        };
 
-        size_t entrySize = sizeof(int) + key.size() + sizeof(int) + value.size();
+        auto flushBatch = [&](bool last)
+        {
+            std::vector<RangeTombstone> tombstones = clipTombstones(last);
+            if (currentBatch.empty() && tombstones.empty())
+                return;
+
+            int newFileId = next_file_id++;
+            BloomFilter bf(std::max<size_t>(currentBatch.size(), 1), bloomBitsPerKey(outputLevel));
+            std::string filename = generateSSTableFilename(outputLevel, newFileId);
+            TableProperties props;
+            std::vector<IndexEntry> index;
+            if (!SSTable::flush(currentBatch, tombstones, filename, bf, tableOptions(outputLevel), index, &props))
+            {
+                std::error_code ec;
+                fs::remove(filename, ec);
+                result.writeFailed = true;
+                return;
+            }
 
-        if (!currentBatch.empty() && currentBatchSize + entrySize > MAX_SSTABLE_SIZE)
+            SSTableMetadata *metadata = new SSTableMetadata{
+                filename,
+                index,
+                bf,
+                newFileId,
+                props.min_key,
+                props.max_key,
+                static_cast<long>(fs::file_size(filename)),
+                props.format_version,
+                tombstones,
+                props.largest_sequence};
+
+            result.outputs.push_back(newTableHandle(metadata, table_cache.get()));
+            currentBatch.clear();
+            currentBatchSize = 0;
+        };
+
+        std::vector<TableEntry> versions;
+
+        while (!minHeap.empty() && !result.writeFailed)
         {
-            flushBatch();
-        }
+            std::string key(minHeap.top().iter->key());
+            uint64_t newer = MAX_SEQUENCE_NUMBER + 1;
+            versions.clear();
 
-        currentBatch.push_back({key, value});
-        currentBatchSize += entrySize;
+            // Every version of the key, newest first; each is seen by the snapshots from its
+            // own sequence up to the next newer version or a tombstone hiding it
+            while (!minHeap.empty() && minHeap.top().iter->key() == key)
+            {
+                IteratorWrapper top = minHeap.top();
+                minHeap.pop();
 
-        lastKey = key;
-        isFirst = false;
+                uint64_t sequence = top.iter->sequence();
+                uint64_t upper = inputTombstones.empty() ? newer : std::min(newer, hiddenFromInputs(top, key, sequence));
+                if (versionVisible(snapshotSequences, sequence, upper))
+                {
+                    versions.push_back({key, std::string(top.iter->value()), top.iter->type(), sequence});
+                }
+                newer = sequence;
 
-        top.iter->next();
-        if (top.iter->hasNext())
-        {
-            minHeap.push(std::move(top));
-        }
-    }
+                top.iter->next();
+                if (top.iter->hasNext() && (!sliceEnd || top.iter->key() < *sliceEnd))
+                {
+                    minHeap.push(top);
+                }
+            }
 
-    flushBatch();
+            if (isBottomLevel)
+            {
+                // Nothing older is left to shadow, so the oldest deletions can go
+                while (!versions.empty() && versions.back().type == ValueType::Deletion)
+                {
+                    versions.pop_back();
+                }
 
-    {
-        std::unique_lock<std::shared_mutex> lock(levels_mutex);
+                for (const auto &version : versions)
+                {
+                    for (size_t i = 0; i < inputTombstones.size(); i++)
+                    {
+                        const RangeTombstone &t = inputTombstones[i].range;
+                        if (t.sequence > version.sequence && t.covers(key))
+                        {
+                            tombstoneNeeded[i] = true;
+                        }
+                    }
+                }
+            }
+
+            if (versions.empty())
+            {
+                continue;
+            }
+
+            // All versions of a key go to one output file
+            size_t groupSize = 0;
+            for (const auto &version : versions)
+            {
+                groupSize += sizeof(int) + key.size() + sizeof(int) + version.value.size();
+            }
+
+            if (!currentBatch.empty() && currentBatchSize + groupSize > options.target_file_size)
+            {
+                flushBatch(false);
+            }
+
+            for (auto &version : versions)
+            {
+                currentBatch.push_back(std::move(version));
+            }
+            currentBatchSize += groupSize;
+        }
 
-        if (needNewLevel)
+        if (!result.writeFailed)
         {
-            levels.push_back({});
+            flushBatch(true);
         }
 
-        std::set<std::string> compactedFilenames;
-        for (const auto &sst : toCompact)
+        for (const auto &iter : inputs)
         {
-            compactedFilenames.insert(sst.filename);
+            if (!iter->ok())
+            {
+                result.corruptFileId = iter->getFileId();
+                return;
+            }
         }
+    };
 
-        levels[level].erase(
-            std::remove_if(levels[level].begin(), levels[level].end(),
-                           [&compactedFilenames](const SSTableMetadata &meta)
-                           {
-                               return compactedFilenames.find(meta.filename) != compactedFilenames.end();
-                           }),
-            levels[level].end());
+    // The compaction worker merges the first slice itself
+    std::vector<std::thread> workers;
+    for (size_t slice = 1; slice < numSlices; slice++)
+    {
+        workers.emplace_back(compactSlice, slice);
+    }
+    compactSlice(0);
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
 
-        std::set<std::string> overlappingFilenames;
-        for (const auto &sst : nextLevelOverlapping)
+    std::vector<TableHandle> newSegmentFiles;
+    std::vector<int> corruptFileIds;
+    bool writeFailed = false;
+    for (const auto &result : results)
+    {
+        if (result.corruptFileId >= 0)
         {
-            overlappingFilenames.insert(sst.filename);
+            corruptFileIds.push_back(result.corruptFileId);
         }
+        writeFailed = writeFailed || result.writeFailed;
+        newSegmentFiles.insert(newSegmentFiles.end(), result.outputs.begin(), result.outputs.end());
+    }
 
-        levels[level + 1].erase(
-            std::remove_if(levels[level + 1].begin(), levels[level + 1].end(),
-                           [&overlappingFilenames](const SSTableMetadata &meta)
-                           {
-                               return overlappingFilenames.find(meta.filename) != overlappingFilenames.end();
-                           }),
-            levels[level + 1].end());
-
-        levels[level + 1].insert(levels[level + 1].end(),
-                                 newSegmentFiles.begin(), newSegmentFiles.end());
+    // Nothing may refer to a table that is not fully on disk
+    if (writeFailed)
+    {
+        std::cerr << "Compaction of level " << level << " aborted: an output SSTable could not be written" << std::endl;
+        for (const auto &sst : newSegmentFiles)
+        {
+            fs::remove(sst->filename);
+        }
+        return false;
+    }
 
-        std::sort(levels[level + 1].begin(), levels[level + 1].end(),
-                  [](const SSTableMetadata &a, const SSTableMetadata &b)
-                  {
-                      return a.minKey < b.minKey;
-                  });
+    // An input that ended early would silently drop its remaining keys; keep the
+    // inputs and throw away the partial output instead. Retrying cannot help, so
+    // the table is not given to a compaction again.
+    if (!corruptFileIds.empty())
+    {
+        std::lock_guard<std::mutex> lock(levels_mutex);
+        for (int fileId : corruptFileIds)
+        {
+            std::cerr << "Compaction of level " << level << " aborted: SSTable (file id " << fileId << ") is unreadable or corrupt; it is left out of further compactions" << std::endl;
+            uncompactable_files.insert(fileId);
+        }
+        for (const auto &sst : newSegmentFiles)
+        {
+            fs::remove(sst->filename);
+        }
+        return true;
     }
 
-    for (const auto &sst : toCompact)
+    // The output of every slice is installed together, as one edit
+    VersionEdit edit;
+    for (const auto &[sst, input_level] : inputTables)
     {
-        fs::remove(sst.filename);
+        edit.removeFile(input_level, sst->fileId);
     }
-    for (const auto &sst : nextLevelOverlapping)
+    for (const auto &sst : newSegmentFiles)
     {
-        fs::remove(sst.filename);
+        edit.addFile(outputLevel, sst);
     }
 
+    // The inputs' files are deleted once the last reader of an older version is done with them
+    std::lock_guard<std::mutex> lock(levels_mutex);
+    if (!installVersion(edit))
     {
-        std::unique_lock<std::shared_mutex> lock(levels_mutex);
-        active_compactions.erase(level);
+        std::cerr << "Compaction of level " << level << " aborted: the MANIFEST could not be updated" << std::endl;
+        for (const auto &sst : newSegmentFiles)
+        {
+            fs::remove(sst->filename);
+        }
+        return false;
     }
-
-    checkCompactionStatus();
+    return true;
 }
\ No newline at end of file
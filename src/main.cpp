@@ -1,10 +1,22 @@
 #include <iostream>
 #include <cassert>
+#include <map>
+#include <set>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 #include "kvstore.h"
+#include "checksum.h"
+#include "SSTableIterator.h"
 
 int main()
 {
-    system("rm -f wal.log *.sst level_*_*.sst");  // Clean up
+    system("rm -f wal.log MANIFEST *.sst level_*_*.sst");  // Clean up
 
     std::cout << "=== TESTING KEY-VALUE STORE ===\n" << std::endl;
 
@@ -66,6 +78,1218 @@ int main()
         std::cout << "✓ Non-existent key returns nullopt" << std::endl;
     }
 
+    // Test 7: Background flush (small memtable forces many flushes and compactions)
+    {
+        system("rm -rf flush_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 1000;
+        {
+            KVStore store("flush_test/wal.log", "flush_test", options);
+            for (int i = 0; i < 20000; i++) {
+                store.put("key_" + std::to_string(i), "value_" + std::to_string(i));
+            }
+            for (int i = 0; i < 20000; i += 7) {
+                auto val = store.get("key_" + std::to_string(i));
+                assert(val && *val == "value_" + std::to_string(i));
+            }
+        }
+        KVStore store("flush_test/wal.log", "flush_test", options);
+        for (int i = 0; i < 20000; i += 7) {
+            auto val = store.get("key_" + std::to_string(i));
+            assert(val && *val == "value_" + std::to_string(i));
+        }
+        std::cout << "✓ Background flush keeps data readable" << std::endl;
+    }
+
+    // Test 8: Block cache serves repeated reads and stays within capacity
+    {
+        BlockCache cache(4096, 1);
+        assert(!cache.lookup(1, 0));
+        cache.insert(1, 0, std::make_shared<std::string>(2048, 'a'));
+        cache.insert(1, 2048, std::make_shared<std::string>(2048, 'b'));
+        assert(cache.lookup(1, 0));
+        cache.insert(2, 0, std::make_shared<std::string>(2048, 'c'));
+        assert(cache.lookup(1, 0) && !cache.lookup(1, 2048) && cache.lookup(2, 0));
+
+        BlockCache::Stats stats = cache.stats();
+        assert(stats.hits == 3 && stats.misses == 2 && stats.usage <= 4096);
+        std::cout << "✓ Block cache" << std::endl;
+    }
+
+    // Test 9: Table cache bounded by max_open_files still serves every table
+    {
+        KVStoreOptions options;
+        options.max_open_files = 2;
+        KVStore store("flush_test/wal.log", "flush_test", options);
+        for (int i = 0; i < 20000; i += 13) {
+            auto val = store.get("key_" + std::to_string(i));
+            assert(val && *val == "value_" + std::to_string(i));
+        }
+        assert(!store.get("key_missing"));
+        std::cout << "✓ Table cache" << std::endl;
+    }
+
+    // Test 10: Iterator merges memtable and every level, hiding overwrites and deletes
+    {
+        system("rm -rf iter_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 500;
+        KVStore store("iter_test/wal.log", "iter_test", options);
+
+        std::map<std::string, std::string> expected;
+        for (int round = 0; round < 3; round++) {
+            for (int i = round; i < 3000; i += 2) {
+                char key[16];
+                snprintf(key, sizeof(key), "key_%05d", i);
+                std::string value = "v" + std::to_string(round) + "_" + std::to_string(i);
+                store.put(key, value);
+                expected[key] = value;
+            }
+        }
+        for (int i = 0; i < 3000; i += 5) {
+            char key[16];
+            snprintf(key, sizeof(key), "key_%05d", i);
+            store.remove(key);
+            expected.erase(key);
+        }
+
+        auto iter = store.newIterator();
+        auto model = expected.begin();
+        for (iter->seekToFirst(); iter->valid(); iter->next(), ++model) {
+            assert(model != expected.end());
+            assert(iter->key() == model->first && iter->value() == model->second);
+        }
+        assert(model == expected.end());
+
+        auto rmodel = expected.rbegin();
+        for (iter->seekToLast(); iter->valid(); iter->prev(), ++rmodel) {
+            assert(iter->key() == rmodel->first && iter->value() == rmodel->second);
+        }
+        assert(rmodel == expected.rend());
+
+        // Direction changes in the middle of the key space
+        iter->seek("key_01000");
+        model = expected.lower_bound("key_01000");
+        assert(iter->key() == model->first);
+        iter->next();
+        iter->prev();
+        iter->prev();
+        assert(iter->key() == std::prev(model)->first);
+
+        ReadOptions read_options;
+        read_options.lower_bound = "key_00100";
+        read_options.upper_bound = "key_00200";
+        auto bounded = store.newIterator(read_options);
+        std::ptrdiff_t count = 0;
+        for (bounded->seekToFirst(); bounded->valid(); bounded->next()) {
+            assert(bounded->key() >= "key_00100" && bounded->key() < "key_00200");
+            count++;
+        }
+        assert(count == std::distance(expected.lower_bound("key_00100"), expected.lower_bound("key_00200")));
+        bounded->seekToLast();
+        assert(bounded->key() == std::prev(expected.lower_bound("key_00200"))->first);
+        assert(bounded->status());
+        std::cout << "✓ Iterator" << std::endl;
+    }
+
+    // Test 11: WriteBatch is applied and recovered as one unit
+    {
+        system("rm -rf batch_test");
+        {
+            KVStore store("batch_test/wal.log", "batch_test");
+            WriteBatch batch;
+            for (int i = 0; i < 100; i++) {
+                batch.put("batch_" + std::to_string(i), "value_" + std::to_string(i));
+            }
+            batch.remove("batch_7");
+            assert(batch.count() == 101);
+            assert(store.write(batch));
+            assert(*store.get("batch_99") == "value_99" && !store.get("batch_7"));
+        }
+        {
+            KVStore store("batch_test/wal.log", "batch_test");
+            assert(*store.get("batch_0") == "value_0" && !store.get("batch_7"));
+
+            WriteBatch torn;
+            torn.put("torn_a", "a");
+            torn.put("torn_b", "b");
+            store.write(torn);
+        }
+        // Cut the last record short, as a crash mid-append would
+        std::filesystem::resize_file("batch_test/wal.log", std::filesystem::file_size("batch_test/wal.log") - 3);
+        KVStore store("batch_test/wal.log", "batch_test");
+        assert(*store.get("batch_42") == "value_42");
+        assert(!store.get("torn_a") && !store.get("torn_b"));
+        std::cout << "✓ WriteBatch" << std::endl;
+    }
+
+    // Test 12: multiGet matches get for found, deleted, duplicate and missing keys
+    {
+        KVStore store("flush_test/wal.log", "flush_test");
+        store.remove("key_500");
+        store.put("key_501", "updated");
+
+        std::vector<std::string> keys = {"key_19999", "key_500", "missing", "key_0", "key_501", "key_123", "key_0"};
+        for (int i = 1000; i < 1300; i += 3) {
+            keys.push_back("key_" + std::to_string(i));
+        }
+
+        auto results = store.multiGet(keys);
+        assert(results.size() == keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            assert(results[i] == store.get(keys[i]));
+        }
+        assert(!results[1] && !results[2] && *results[4] == "updated" && *results[6] == "value_0");
+        std::cout << "✓ MultiGet" << std::endl;
+    }
+
+    // Test 13: compressed tables read back the same after reopening
+    {
+        system("rm -rf compress_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 1000;
+        options.compression_per_level = {CompressionType::LZ};
+        std::string padding(200, 'x');
+        {
+            KVStore store("compress_test/wal.log", "compress_test", options);
+            for (int i = 0; i < 5000; i++) {
+                store.put("key_" + std::to_string(i), "value_" + std::to_string(i) + padding);
+            }
+        }
+
+        uintmax_t table_bytes = 0;
+        for (const auto &entry : std::filesystem::recursive_directory_iterator("compress_test")) {
+            if (entry.path().extension() == ".sst") {
+                table_bytes += entry.file_size();
+            }
+        }
+        assert(table_bytes > 0 && table_bytes < 5000 * padding.size() / 2);
+
+        KVStore store("compress_test/wal.log", "compress_test", options);
+        for (int i = 0; i < 5000; i += 7) {
+            assert(*store.get("key_" + std::to_string(i)) == "value_" + std::to_string(i) + padding);
+        }
+        auto iter = store.newIterator();
+        size_t count = 0;
+        for (iter->seekToFirst(); iter->valid(); iter->next()) {
+            count++;
+        }
+        assert(count == 5000);
+        assert(store.compressionStats().blocks_decompressed > 0);
+        std::cout << "✓ Block compression" << std::endl;
+    }
+
+    // Test 14: CRC-32C and per-block checksums
+    {
+        assert(crc32c(std::string_view("123456789")) == 0xE3069283u);
+        assert(crc32c(std::string(32, '\0')) == 0x8A9136AAu);
+        std::string text = "The quick brown fox jumps over the lazy dog, twice over.";
+        uint32_t split = crc32c_update(crc32c(std::string_view(text).substr(0, 13)), reinterpret_cast<const uint8_t *>(text.data() + 13), text.size() - 13);
+        assert(split == crc32c(text));
+
+        system("rm -rf checksum_test && mkdir -p checksum_test");
+        std::string path = "checksum_test/table.sst";
+        std::vector<TableEntry> data;
+        for (int i = 0; i < 1000; i++) {
+            char key[16];
+            snprintf(key, sizeof(key), "key_%04d", i);
+            data.push_back({key, "value_" + std::to_string(i)});
+        }
+        BloomFilter bf(data.size(), 10);
+        std::vector<IndexEntry> index;
+        bool written = SSTable::flush(data, {}, path, bf, TableBuilderOptions(), index);
+        assert(written);
+
+        // Flip one byte of a value in the first data block
+        std::string bytes;
+        {
+            std::ifstream in(path, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        size_t pos = bytes.find("value_5");
+        assert(pos != std::string::npos && pos < static_cast<size_t>(index[0].size));
+        bytes[pos] ^= 0x20;
+        {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            out.write(bytes.data(), bytes.size());
+        }
+
+        std::string value;
+        ValueType type;
+        auto verified = TableReader::open(path, 1);
+        assert(!SSTable::search(*verified, index, "key_0005", value, type));
+        assert(SSTable::search(*verified, index, "key_0999", value, type) && value == "value_999");
+        assert(!SSTable::search(path, index, "key_0005", value, type));
+
+        TableReaderOptions unchecked;
+        unchecked.verify_checksums = false;
+        auto trusting = TableReader::open(path, 2, unchecked);
+        assert(SSTable::search(*trusting, index, "key_0005", value, type) && value == "Value_5");
+
+        // A scan skips the damaged block but reports it
+        TableIterator scan(verified, &index);
+        scan.seekToFirst();
+        assert(scan.valid() && scan.key() > index[0].key);
+        assert(!scan.ok());
+        std::cout << "✓ Block checksums" << std::endl;
+    }
+
+    // Test 15: deleteRange across memtable and tables; "TOMBSTONE" is an ordinary value
+    {
+        system("rm -rf range_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 500;
+        std::map<std::string, std::string> expected;
+        auto key = [](int i) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "key_%05d", i);
+            return std::string(buf);
+        };
+        auto check = [&](KVStore &store) {
+            std::vector<std::string> keys;
+            for (int i = 0; i < 6000; i += 7) {
+                keys.push_back(key(i));
+            }
+            auto results = store.multiGet(keys);
+            for (size_t i = 0; i < keys.size(); i++) {
+                auto it = expected.find(keys[i]);
+                auto want = it == expected.end() ? std::nullopt : std::make_optional(it->second);
+                assert(store.get(keys[i]) == want && results[i] == want);
+            }
+
+            auto iter = store.newIterator();
+            auto e = expected.begin();
+            for (iter->seekToFirst(); iter->valid(); iter->next(), ++e) {
+                assert(e != expected.end() && iter->key() == e->first && iter->value() == e->second);
+            }
+            assert(e == expected.end());
+            auto r = expected.rbegin();
+            for (iter->seekToLast(); iter->valid(); iter->prev(), ++r) {
+                assert(iter->key() == r->first);
+            }
+            assert(r == expected.rend());
+            iter->seek(key(1500));
+            assert(iter->key() == expected.lower_bound(key(1500))->first);
+        };
+        auto eraseRange = [&](int begin, int end) {
+            expected.erase(expected.lower_bound(key(begin)), expected.lower_bound(key(end)));
+        };
+
+        {
+            KVStore store("range_test/wal.log", "range_test", options);
+            for (int i = 0; i < 5000; i++) {
+                store.put(key(i), "value_" + std::to_string(i));
+                expected[key(i)] = "value_" + std::to_string(i);
+            }
+            store.put("literal", "TOMBSTONE");
+            expected["literal"] = "TOMBSTONE";
+
+            store.deleteRange(key(1000), key(3000));
+            eraseRange(1000, 3000);
+            store.put(key(2000), "revived");
+            expected[key(2000)] = "revived";
+            store.deleteRange(key(4990), key(6000));
+            eraseRange(4990, 6000);
+            store.deleteRange(key(10), key(10));
+
+            WriteBatch batch;
+            batch.put(key(5500), "batched");
+            batch.deleteRange(key(100), key(200));
+            batch.put(key(150), "after_range");
+            assert(store.write(batch));
+            eraseRange(100, 200);
+            expected[key(5500)] = "batched";
+            expected[key(150)] = "after_range";
+            check(store);
+
+            // Push the tombstones down through flushes and compactions
+            for (int i = 5000; i < 6000; i++) {
+                if (i % 2 == 0) {
+                    store.put(key(i), "late_" + std::to_string(i));
+                    expected[key(i)] = "late_" + std::to_string(i);
+                }
+            }
+            store.deleteRange(key(5200), key(5300));
+            eraseRange(5200, 5300);
+            check(store);
+        }
+        KVStore store("range_test/wal.log", "range_test", options);
+        check(store);
+        assert(*store.get("literal") == "TOMBSTONE");
+
+        // A reversed range in a batch deletes nothing, before or after replay
+        system("rm -rf reversed_range_test");
+        {
+            KVStore reversed("reversed_range_test/wal.log", "reversed_range_test");
+            WriteBatch batch;
+            batch.put("key_5", "kept");
+            batch.deleteRange("key_9", "key_1");
+            assert(reversed.write(batch));
+        }
+        {
+            KVStoreOptions flush_on_replay;
+            flush_on_replay.memtable_max_entries = 1;
+            KVStore reversed("reversed_range_test/wal.log", "reversed_range_test", flush_on_replay);
+            assert(*reversed.get("key_5") == "kept");
+        }
+        for (const auto &entry : std::filesystem::directory_iterator("reversed_range_test")) {
+            if (entry.path().extension() == ".sst") {
+                std::vector<IndexEntry> table_index;
+                BloomFilter table_bf;
+                TableProperties props;
+                bool loaded = SSTable::loadIndex(entry.path().string(), table_index, table_bf, &props);
+                assert(loaded && props.num_range_deletions == 0 && props.min_key <= props.max_key);
+            }
+        }
+        std::cout << "✓ Range deletion" << std::endl;
+    }
+
+    // Test 16: snapshots keep their view across writes, flushes and compactions
+    {
+        system("rm -rf snapshot_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 300;
+        auto key = [](int i) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "key_%05d", i);
+            return std::string(buf);
+        };
+        {
+            KVStore store("snapshot_test/wal.log", "snapshot_test", options);
+            for (int i = 0; i < 1000; i++) {
+                store.put(key(i), "old_" + std::to_string(i));
+            }
+
+            const Snapshot *snap = store.getSnapshot();
+            ReadOptions at_snap;
+            at_snap.snapshot = snap;
+
+            store.put(key(1), "new");
+            store.remove(key(3));
+            store.deleteRange(key(100), key(200));
+            // Enough writes to flush and compact while the snapshot is held
+            for (int round = 0; round < 5; round++) {
+                for (int i = 0; i < 1000; i += 2) {
+                    store.put(key(i), "r" + std::to_string(round));
+                }
+            }
+
+            assert(*store.get(key(1), at_snap) == "old_1");
+            assert(*store.get(key(3), at_snap) == "old_3");
+            assert(*store.get(key(150), at_snap) == "old_150");
+            assert(*store.get(key(1)) == "new");
+            assert(!store.get(key(3)).has_value());
+            assert(!store.get(key(151)).has_value());
+            assert(*store.get(key(150)) == "r4");
+
+            std::vector<int> ids = {1, 3, 151, 998};
+            std::vector<std::string> keys;
+            for (int i : ids) {
+                keys.push_back(key(i));
+            }
+            auto results = store.multiGet(keys, at_snap);
+            for (size_t i = 0; i < ids.size(); i++) {
+                assert(results[i] && *results[i] == "old_" + std::to_string(ids[i]));
+            }
+
+            int count = 0;
+            auto iter = store.newIterator(at_snap);
+            for (iter->seekToFirst(); iter->valid(); iter->next(), count++) {
+                assert(iter->value() == "old_" + std::to_string(count));
+            }
+            assert(count == 1000);
+
+            store.releaseSnapshot(snap);
+        }
+
+        // A batch becomes visible all at once to readers on other threads
+        {
+            KVStore store("snapshot_test/wal.log", "snapshot_test", options);
+            assert(*store.get(key(1)) == "new" && !store.get(key(3)).has_value());
+
+            std::atomic<bool> done{false};
+            std::thread writer([&] {
+                for (int i = 0; i < 2000; i++) {
+                    WriteBatch batch;
+                    batch.put("pair_a", std::to_string(i));
+                    batch.put("pair_b", std::to_string(i));
+                    store.write(batch);
+                }
+                done = true;
+            });
+            while (!done) {
+                const Snapshot *snap = store.getSnapshot();
+                ReadOptions at_snap;
+                at_snap.snapshot = snap;
+                assert(store.get("pair_a", at_snap) == store.get("pair_b", at_snap));
+                store.releaseSnapshot(snap);
+            }
+            writer.join();
+        }
+        std::cout << "✓ Snapshots" << std::endl;
+    }
+
+    // Test 17: compacted tables stay on disk while an iterator's version still lists them
+    {
+        system("rm -rf version_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 500;
+        auto key = [](int i) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "key_%05d", i);
+            return std::string(buf);
+        };
+        auto tableFiles = [] {
+            std::set<std::string> files;
+            for (const auto &entry : std::filesystem::directory_iterator("version_test")) {
+                if (entry.path().extension() == ".sst") {
+                    files.insert(entry.path().filename().string());
+                }
+            }
+            return files;
+        };
+
+        // Few enough level-0 tables that reopening does not start a compaction
+        {
+            KVStore store("version_test/wal.log", "version_test", options);
+            for (int i = 0; i < 2000; i++) {
+                store.put(key(i), "old");
+            }
+        }
+
+        std::set<std::string> pinned;
+        {
+            KVStore store("version_test/wal.log", "version_test", options);
+            pinned = tableFiles();
+            auto iter = store.newIterator();
+
+            // Enough flushes to compact every table the iterator is reading
+            for (int round = 0; round < 4; round++) {
+                for (int i = 0; i < 2000; i++) {
+                    store.put(key(i), "new_" + std::to_string(round));
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+            std::set<std::string> live = tableFiles();
+            for (const auto &file : pinned) {
+                assert(live.count(file));
+            }
+
+            int count = 0;
+            for (iter->seekToFirst(); iter->valid(); iter->next(), count++) {
+                assert(iter->key() == key(count) && iter->value() == "old");
+            }
+            assert(count == 2000);
+            assert(*store.get(key(42)) == "new_3");
+        }
+
+        std::set<std::string> live = tableFiles();
+        size_t removed = 0;
+        for (const auto &file : pinned) {
+            removed += live.count(file) == 0;
+        }
+        assert(removed > 0);
+
+        KVStore store("version_test/wal.log", "version_test", options);
+        for (int i = 0; i < 2000; i += 11) {
+            assert(*store.get(key(i)) == "new_3");
+        }
+        std::cout << "✓ Versions keep compacted tables until released" << std::endl;
+    }
+
+    // Test 18: MANIFEST replay, torn tail, orphaned tables and stores without a MANIFEST
+    {
+        system("rm -rf manifest_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 500;
+        auto check = [](KVStore &store) {
+            for (int i = 0; i < 5000; i += 3) {
+                auto val = store.get("key_" + std::to_string(i));
+                assert(val && *val == "value_" + std::to_string(i));
+            }
+        };
+        {
+            KVStore store("manifest_test/wal.log", "manifest_test", options);
+            for (int i = 0; i < 5000; i++) {
+                store.put("key_" + std::to_string(i), "value_" + std::to_string(i));
+            }
+        }
+        assert(std::filesystem::exists("manifest_test/MANIFEST"));
+
+        // A table no edit recorded (a crash mid-compaction) and a half-written record
+        std::ofstream("manifest_test/level_1_99999.sst") << "unfinished output";
+        std::ofstream("manifest_test/MANIFEST", std::ios::app) << std::string("\x10\x00\x00", 3);
+        {
+            KVStore store("manifest_test/wal.log", "manifest_test", options);
+            check(store);
+        }
+        assert(!std::filesystem::exists("manifest_test/level_1_99999.sst"));
+
+        std::filesystem::remove("manifest_test/MANIFEST");
+        {
+            KVStore store("manifest_test/wal.log", "manifest_test", options);
+            check(store);
+        }
+        assert(std::filesystem::exists("manifest_test/MANIFEST"));
+
+        KVStore store("manifest_test/wal.log", "manifest_test", options);
+        check(store);
+        std::cout << "✓ MANIFEST" << std::endl;
+    }
+
+    // Test 19: Parallel table loading builds the same version as loading one table at a time
+    {
+        system("rm -rf parallel_load_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 300;
+        {
+            KVStore store("parallel_load_test/wal.log", "parallel_load_test", options);
+            // Large enough values that compaction output spans several tables
+            for (int i = 0; i < 3000; i++) {
+                store.put("key_" + std::to_string(i), "value_" + std::to_string(i) + std::string(1000, 'x'));
+            }
+            store.deleteRange("key_1000", "key_1100");
+        }
+
+        auto scan = [&](int threads) {
+            options.table_loading_threads = threads;
+            KVStore store("parallel_load_test/wal.log", "parallel_load_test", options);
+            StartupStats stats = store.startupStats();
+            assert(stats.tables_loaded > 1);
+            assert(stats.table_loading_threads == std::min<int>(threads, stats.tables_loaded));
+            assert(stats.total_micros >= stats.table_load_micros);
+
+            std::vector<std::pair<std::string, std::string>> entries;
+            auto it = store.newIterator();
+            for (it->seekToFirst(); it->valid(); it->next()) {
+                entries.push_back({std::string(it->key()), std::string(it->value())});
+            }
+            return entries;
+        };
+
+        auto sequential = scan(1);
+        auto parallel = scan(4);
+        assert(!sequential.empty());
+        assert(std::find_if(sequential.begin(), sequential.end(), [](const auto &entry) { return entry.first == "key_1050"; }) == sequential.end());
+        assert(sequential == parallel);
+        std::cout << "✓ Parallel table loading" << std::endl;
+    }
+
+    // Test 20: Streaming WAL replay
+    {
+        system("rm -rf replay_test");
+        std::filesystem::create_directory("replay_test");
+
+        // Records past a corrupt one are dropped, however many threads verify the chunks
+        {
+            WAL wal("replay_test/raw.log", WALSyncPolicy::Never);
+            for (int i = 0; i < 200; i++) {
+                wal.write("key_" + std::to_string(i), std::string(20000, 'a' + i % 26), ValueType::Value, i + 1);
+            }
+        }
+        assert(WAL::readAllFromFile("replay_test/raw.log").size() == 200);
+        {
+            std::fstream file("replay_test/raw.log", std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(150 * (sizeof(WALRecordHeader) + 8 + 7 + 20000) + 100);
+            file.put('!');
+        }
+        auto entries = WAL::readAllFromFile("replay_test/raw.log");
+        assert(entries.size() == 150 && entries.back().key == "key_149" && entries.back().sequence == 150);
+        size_t replayed = WAL::replayFile("replay_test/raw.log", [](ValueType, std::string_view, std::string_view, uint64_t) {}, 4);
+        assert(replayed == 150);
+
+        // A torn tail is cut off at startup, so writes appended afterwards replay too
+        {
+            KVStore store("replay_test/torn/wal.log", "replay_test/torn");
+            for (int i = 0; i < 10; i++) {
+                store.put("key_" + std::to_string(i), "value_" + std::to_string(i));
+            }
+        }
+        size_t intact_size = std::filesystem::file_size("replay_test/torn/wal.log");
+        {
+            std::ofstream file("replay_test/torn/wal.log", std::ios::binary | std::ios::app);
+            file.write("\xEF\xBE\xAD\xDE\x04", 5);
+        }
+        {
+            KVStore store("replay_test/torn/wal.log", "replay_test/torn");
+            assert(store.startupStats().wal_entries == 10);
+            assert(std::filesystem::file_size("replay_test/torn/wal.log") == intact_size);
+            store.put("key_10", "value_10");
+        }
+        {
+            KVStore store("replay_test/torn/wal.log", "replay_test/torn");
+            assert(store.startupStats().wal_entries == 11);
+            assert(store.get("key_10") == "value_10");
+        }
+
+        // A log larger than the memtable is flushed to tables during replay, then emptied
+        KVStoreOptions options;
+        {
+            KVStore store("replay_test/wal.log", "replay_test", options);
+            for (int i = 0; i < 5000; i++) {
+                store.put("key_" + std::to_string(i), "value_" + std::to_string(i));
+            }
+            WriteBatch batch;
+            batch.put("key_0", "batched");
+            batch.remove("key_1");
+            store.write(batch);
+        }
+        auto check = [](KVStore &store) {
+            assert(*store.get("key_0") == "batched");
+            assert(!store.get("key_1"));
+            for (int i = 2; i < 5000; i++) {
+                assert(*store.get("key_" + std::to_string(i)) == "value_" + std::to_string(i));
+            }
+        };
+
+        options.memtable_max_entries = 700;
+        {
+            KVStore store("replay_test/wal.log", "replay_test", options);
+            assert(store.startupStats().wal_entries == 5002);
+            assert(std::filesystem::file_size("replay_test/wal.log") == 0);
+            check(store);
+        }
+        KVStore store("replay_test/wal.log", "replay_test", options);
+        assert(store.startupStats().wal_entries == 0);
+        check(store);
+        std::cout << "✓ Streaming WAL replay" << std::endl;
+    }
+
+    // Test 21: Levels settle under their byte targets
+    {
+        system("rm -rf leveled_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 1000;
+        options.max_bytes_for_level_base = 256 * 1024;
+        options.max_bytes_for_level_multiplier = 4;
+        options.target_file_size = 64 * 1024;
+
+        // Table count and bytes per level
+        auto levelFiles = [] {
+            std::map<int, std::pair<size_t, uint64_t>> files;
+            for (const auto &entry : std::filesystem::directory_iterator("leveled_test")) {
+                std::string name = entry.path().filename().string();
+                // Compaction may delete a table between listing and sizing it
+                std::error_code ec;
+                uint64_t size = entry.file_size(ec);
+                if (entry.path().extension() == ".sst" && !ec) {
+                    auto &level = files[std::stoi(name.substr(6))];
+                    level.first++;
+                    level.second += size;
+                }
+            }
+            return files;
+        };
+        auto settled = [&] {
+            auto files = levelFiles();
+            if (files[0].first >= options.level0_compaction_trigger) {
+                return false;
+            }
+            uint64_t target = options.max_bytes_for_level_base;
+            for (int level = 1; level < files.rbegin()->first; level++) {
+                if (files[level].second > target) {
+                    return false;
+                }
+                target *= options.max_bytes_for_level_multiplier;
+            }
+            return true;
+        };
+
+        // Values that do not compress, so table sizes track the data written
+        auto value = [](int round, int i) {
+            std::string v = std::to_string(round);
+            uint32_t x = i * 2654435761u + round;
+            while (v.size() < 200) {
+                x = x * 1103515245u + 12345u;
+                v += static_cast<char>('!' + (x >> 16) % 90);
+            }
+            return v;
+        };
+
+        KVStore store("leveled_test/wal.log", "leveled_test", options);
+        for (int round = 0; round < 2; round++) {
+            for (int i = 0; i < 20000; i++) {
+                store.put("key_" + std::to_string(i), value(round, i));
+            }
+        }
+        for (int wait = 0; wait < 100 && !settled(); wait++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        assert(settled());
+        // Data spreads over a few levels instead of cascading one level deeper per compaction
+        auto files = levelFiles();
+        assert(files.rbegin()->first >= 2 && files.rbegin()->first <= 4);
+
+        for (int i = 0; i < 20000; i += 7) {
+            assert(*store.get("key_" + std::to_string(i)) == value(1, i));
+        }
+        std::cout << "✓ Leveled compaction size targets" << std::endl;
+    }
+
+    // Test 22: Subcompactions produce the same data as a single merge
+    {
+        auto key = [](int i) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "key_%05d", i);
+            return std::string(buf);
+        };
+        auto value = [](int round, int i) {
+            return std::to_string(round) + "_" + std::to_string(i) + std::string(100, 'a' + (i + round) % 26);
+        };
+
+        // Latest contents and contents at a snapshot taken between the two rounds
+        auto run = [&](int subcompactions) {
+            system("rm -rf subcompaction_test");
+            KVStoreOptions options;
+            options.memtable_max_entries = 1000;
+            options.target_file_size = 16 * 1024;
+            options.max_subcompactions = subcompactions;
+            options.max_bytes_for_level_base = 64 * 1024 * 1024;
+
+            KVStore store("subcompaction_test/wal.log", "subcompaction_test", options);
+            for (int i = 0; i < 10000; i++) {
+                store.put(key(i), value(0, i));
+            }
+            const Snapshot *snap = store.getSnapshot();
+            store.deleteRange(key(2000), key(3000));
+            for (int i = 0; i < 10000; i++) {
+                if (i % 10 == 0) {
+                    store.remove(key(i));
+                } else if (i % 3 == 0) {
+                    store.put(key(i), value(1, i));
+                }
+            }
+
+            auto level0Tables = [] {
+                size_t count = 0;
+                for (const auto &entry : std::filesystem::directory_iterator("subcompaction_test")) {
+                    count += entry.path().filename().string().rfind("level_0_", 0) == 0;
+                }
+                return count;
+            };
+            for (int wait = 0; wait < 100 && level0Tables() >= options.level0_compaction_trigger; wait++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            assert(level0Tables() < options.level0_compaction_trigger);
+
+            auto scan = [&](const ReadOptions &read_options) {
+                std::vector<std::pair<std::string, std::string>> entries;
+                auto it = store.newIterator(read_options);
+                for (it->seekToFirst(); it->valid(); it->next()) {
+                    entries.push_back({std::string(it->key()), std::string(it->value())});
+                }
+                return entries;
+            };
+            ReadOptions at_snap;
+            at_snap.snapshot = snap;
+            auto result = std::make_pair(scan(ReadOptions()), scan(at_snap));
+            store.releaseSnapshot(snap);
+            return result;
+        };
+
+        auto single = run(1);
+        auto parallel = run(4);
+        assert(single == parallel);
+
+        std::vector<std::pair<std::string, std::string>> latest, original;
+        for (int i = 0; i < 10000; i++) {
+            original.push_back({key(i), value(0, i)});
+            if (i % 10 != 0 && (i < 2000 || i >= 3000 || i % 3 == 0)) {
+                latest.push_back({key(i), value(i % 3 == 0 ? 1 : 0, i)});
+            }
+        }
+        assert(parallel.first == latest);
+        assert(parallel.second == original);
+        std::cout << "✓ Parallel subcompactions" << std::endl;
+    }
+
+    // Test 23: Universal compaction keeps few sorted runs and stays readable as leveled
+    {
+        system("rm -rf universal_test");
+        auto key = [](int i) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "key_%05d", i);
+            return std::string(buf);
+        };
+
+        // Each level 0 table is a run of its own; each deeper level holds one
+        auto sortedRuns = [] {
+            std::set<std::string> levels;
+            size_t runs = 0;
+            for (const auto &entry : std::filesystem::directory_iterator("universal_test")) {
+                std::string name = entry.path().filename().string();
+                if (name.rfind("level_0_", 0) == 0) {
+                    runs++;
+                } else if (name.rfind("level_", 0) == 0) {
+                    levels.insert(name.substr(0, name.find('_', 6)));
+                }
+            }
+            return runs + levels.size();
+        };
+
+        KVStoreOptions options;
+        options.memtable_max_entries = 1000;
+        options.compaction_style = CompactionStyle::Universal;
+        options.level0_compaction_trigger = 4;
+
+        std::map<std::string, std::string> model;
+        {
+            KVStore store("universal_test/wal.log", "universal_test", options);
+            for (int round = 0; round < 8; round++) {
+                for (int i = round; i < 12000; i += 2) {
+                    std::string value = std::to_string(round) + "_" + std::to_string(i);
+                    store.put(key(i), value);
+                    model[key(i)] = value;
+                }
+                for (int i = round * 1000; i < round * 1000 + 200; i++) {
+                    store.remove(key(i));
+                    model.erase(key(i));
+                }
+            }
+
+            for (int wait = 0; wait < 100 && sortedRuns() >= options.level0_compaction_trigger; wait++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            assert(sortedRuns() < options.level0_compaction_trigger);
+
+            for (int i = 0; i < 12000; i++) {
+                auto value = store.get(key(i));
+                assert(value.has_value() == (model.count(key(i)) == 1));
+                assert(!value || *value == model[key(i)]);
+            }
+        }
+
+        // The tables stay in key order within each level, so a leveled store reads them as is
+        options.compaction_style = CompactionStyle::Leveled;
+        {
+            KVStore store("universal_test/wal.log", "universal_test", options);
+            auto expected = model.begin();
+            auto it = store.newIterator(ReadOptions());
+            for (it->seekToFirst(); it->valid(); it->next(), ++expected) {
+                assert(expected != model.end());
+                assert(it->key() == expected->first && it->value() == expected->second);
+            }
+            assert(expected == model.end());
+        }
+        std::cout << "✓ Universal compaction" << std::endl;
+    }
+
+    // Test 24: A failed flush keeps the memtable and its rotated log until a table is written
+    {
+        system("rm -rf flush_failure_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 100;
+
+        auto key = [](int i) { return "key_" + std::to_string(i); };
+        auto checkAll = [&](KVStore &store) {
+            for (int i = 0; i < 150; i++) {
+                auto value = store.get(key(i));
+                assert(value && *value == "value_" + std::to_string(i));
+            }
+        };
+
+        // Non-empty directories where the next level 0 tables would go make their writes fail
+        auto blockTables = [](bool blocked) {
+            for (int id = 1; id <= 100; id++) {
+                std::string path = "flush_failure_test/level_0_" + std::to_string(id) + ".sst";
+                if (blocked) {
+                    std::filesystem::create_directory(path);
+                    std::ofstream(path + "/keep");
+                } else {
+                    std::filesystem::remove_all(path);
+                }
+            }
+        };
+
+        {
+            KVStore store("flush_failure_test/wal.log", "flush_failure_test", options);
+            blockTables(true);
+            for (int i = 0; i < 150; i++) {
+                store.put(key(i), "value_" + std::to_string(i));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            checkAll(store);
+            assert(std::filesystem::exists("flush_failure_test/wal.log.tmp"));
+        }
+
+        // Still failing at startup, the recovered memtable waits for the flush thread
+        {
+            KVStore store("flush_failure_test/wal.log", "flush_failure_test", options);
+            checkAll(store);
+            assert(std::filesystem::exists("flush_failure_test/wal.log.tmp"));
+
+            blockTables(false);
+            for (int wait = 0; wait < 50 && std::filesystem::exists("flush_failure_test/wal.log.tmp"); wait++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            assert(!std::filesystem::exists("flush_failure_test/wal.log.tmp"));
+            checkAll(store);
+        }
+
+        {
+            KVStore store("flush_failure_test/wal.log", "flush_failure_test", options);
+            checkAll(store);
+        }
+        std::cout << "✓ Failed flushes" << std::endl;
+    }
+
+    // Test 25: A table with an unreadable index is left out at startup but kept on disk
+    {
+        system("rm -rf unreadable_test");
+        KVStoreOptions options;
+        options.memtable_max_entries = 100;
+        auto key = [](int i) { return "key_" + std::to_string(1000 + i); };
+
+        {
+            KVStore store("unreadable_test/wal.log", "unreadable_test", options);
+            for (int i = 0; i < 150; i++) {
+                store.put(key(i), "value_" + std::to_string(i));
+            }
+        }
+
+        std::string table;
+        for (const auto &entry : std::filesystem::directory_iterator("unreadable_test")) {
+            if (entry.path().extension() == ".sst") {
+                table = entry.path().string();
+            }
+        }
+        assert(!table.empty());
+
+        // The index block sits right before the footer
+        std::string original;
+        {
+            std::ifstream in(table, std::ios::binary);
+            original.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        auto writeTable = [&table](const std::string &bytes) {
+            std::ofstream out(table, std::ios::binary | std::ios::trunc);
+            out.write(bytes.data(), bytes.size());
+        };
+        std::string damaged = original;
+        damaged[damaged.size() - Footer::ENCODED_LENGTH - 8] ^= 0x01;
+        writeTable(damaged);
+
+        for (int open = 0; open < 2; open++) {
+            KVStore store("unreadable_test/wal.log", "unreadable_test", options);
+            assert(!store.get(key(0)));
+            assert(store.get(key(149)) == "value_149");
+            assert(std::filesystem::exists(table));
+        }
+
+        writeTable(original);
+        {
+            KVStore store("unreadable_test/wal.log", "unreadable_test", options);
+            for (int i = 0; i < 150; i++) {
+                assert(store.get(key(i)) == "value_" + std::to_string(i));
+            }
+        }
+
+        // Once newer writes to its keys are compacted below it, a table that reads
+        // again stays left out instead of shadowing them
+        writeTable(damaged);
+        options.level0_compaction_trigger = 2;
+        auto level0Tables = [&table] {
+            size_t count = 0;
+            for (const auto &entry : std::filesystem::directory_iterator("unreadable_test")) {
+                count += entry.path().filename().string().rfind("level_0_", 0) == 0 && entry.path().string() != table;
+            }
+            return count;
+        };
+        {
+            KVStore store("unreadable_test/wal.log", "unreadable_test", options);
+            for (int i = 0; i < 100; i++) {
+                store.put(key(i), "new_" + std::to_string(i));
+            }
+            for (int i = 200; i < 400; i++) {
+                store.put(key(i), "value_" + std::to_string(i));
+            }
+            for (int wait = 0; wait < 100 && level0Tables() >= options.level0_compaction_trigger; wait++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            assert(level0Tables() < options.level0_compaction_trigger);
+        }
+
+        writeTable(original);
+        {
+            KVStore store("unreadable_test/wal.log", "unreadable_test", options);
+            for (int i = 0; i < 100; i++) {
+                assert(store.get(key(i)) == "new_" + std::to_string(i));
+            }
+            assert(store.get(key(149)) == "value_149");
+            assert(store.get(key(399)) == "value_399");
+            assert(std::filesystem::exists(table));
+        }
+        std::cout << "✓ Unreadable tables at startup" << std::endl;
+    }
+
+    // Test 26: Concurrent writers share group commits and every acknowledged write survives a
+    // restart; the skiplist keeps the newest version of keys overwritten from several threads
+    {
+        system("rm -rf group_commit_test");
+        KVStoreOptions options;
+        options.wal_sync_policy = WALSyncPolicy::EveryCommit;
+        const int threads = 8;
+        const int per_thread = 500;
+        auto key = [](int t, int i) { return "key_" + std::to_string(t) + "_" + std::to_string(i); };
+
+        {
+            KVStore store("group_commit_test/wal.log", "group_commit_test", options);
+            std::vector<std::thread> writers;
+            for (int t = 0; t < threads; t++) {
+                writers.emplace_back([&, t] {
+                    for (int i = 0; i < per_thread; i++) {
+                        store.put(key(t, i), "value_" + std::to_string(i));
+                    }
+                });
+            }
+            for (auto &writer : writers) {
+                writer.join();
+            }
+        }
+
+        KVStore store("group_commit_test/wal.log", "group_commit_test", options);
+        assert(store.startupStats().wal_entries == threads * per_thread);
+        for (int t = 0; t < threads; t++) {
+            for (int i = 0; i < per_thread; i++) {
+                assert(store.get(key(t, i)) == "value_" + std::to_string(i));
+            }
+        }
+
+        // Writers overwrite the same keys while readers look them up
+        MemTable mem;
+        std::atomic<uint64_t> next_sequence{1};
+        std::atomic<bool> writing{true};
+        const int shared_keys = 64;
+        std::vector<std::vector<std::pair<uint64_t, int>>> written(threads / 2);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads / 2; t++) {
+            workers.emplace_back([&, t] {
+                for (int i = 0; i < per_thread * 4; i++) {
+                    int k = i % shared_keys;
+                    uint64_t sequence = next_sequence++;
+                    mem.put("shared_" + std::to_string(k), "seq_" + std::to_string(sequence), sequence);
+                    written[t].push_back({sequence, k});
+                }
+            });
+        }
+        for (int t = 0; t < threads / 2; t++) {
+            workers.emplace_back([&] {
+                std::string value;
+                ValueType type;
+                while (writing) {
+                    for (int k = 0; k < shared_keys; k++) {
+                        if (mem.get("shared_" + std::to_string(k), MAX_SEQUENCE_NUMBER, value, type)) {
+                            assert(type == ValueType::Value && value.rfind("seq_", 0) == 0);
+                        }
+                    }
+                }
+            });
+        }
+        for (int t = 0; t < threads / 2; t++) {
+            workers[t].join();
+        }
+        writing = false;
+        for (int t = threads / 2; t < threads; t++) {
+            workers[t].join();
+        }
+
+        std::vector<uint64_t> newest(shared_keys, 0);
+        for (const auto &log : written) {
+            for (const auto &[sequence, k] : log) {
+                newest[k] = std::max(newest[k], sequence);
+            }
+        }
+        for (int k = 0; k < shared_keys; k++) {
+            std::string value;
+            ValueType type;
+            assert(mem.get("shared_" + std::to_string(k), MAX_SEQUENCE_NUMBER, value, type));
+            assert(value == "seq_" + std::to_string(newest[k]));
+        }
+        assert(mem.size() == static_cast<size_t>(shared_keys));
+        std::cout << "✓ Concurrent writers (group commit, skiplist)" << std::endl;
+    }
+
+    // Test 27: A failed compaction is not retried back to back
+    {
+        KVStoreOptions options;
+        options.memtable_max_entries = 100;
+        auto key = [](int i) { return "key_" + std::to_string(1000 + i); };
+        auto countLines = [](const std::string &log, const std::string &text) {
+            size_t count = 0;
+            for (size_t pos = log.find(text); pos != std::string::npos; pos = log.find(text, pos + 1)) {
+                count++;
+            }
+            return count;
+        };
+        auto writeTables = [&](const std::string &dir) {
+            system(("rm -rf " + dir).c_str());
+            KVStore store(dir + "/wal.log", dir, options);
+            for (int i = 0; i < 250; i++) {
+                store.put(key(i), "value_" + std::to_string(i));
+            }
+        };
+
+        // A corrupt input is left out of compactions after the first failure
+        writeTables("compaction_failure_test");
+        {
+            std::fstream file("compaction_failure_test/level_0_1.sst", std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(20);
+            file.put('!');
+        }
+        options.level0_compaction_trigger = 2;
+        std::ostringstream log;
+        std::streambuf *cerr_buf = std::cerr.rdbuf(log.rdbuf());
+        {
+            KVStore store("compaction_failure_test/wal.log", "compaction_failure_test", options);
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            for (int i = 250; i < 400; i++) {
+                store.put(key(i), "value_" + std::to_string(i));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            assert(store.get(key(399)) == "value_399");
+        }
+        std::cerr.rdbuf(cerr_buf);
+        assert(countLines(log.str(), "aborted") == 1);
+
+        // Outputs that cannot be written are retried after a pause, until they can be
+        options.level0_compaction_trigger = 5;
+        writeTables("compaction_retry_test");
+        for (int id = 1; id <= 100; id++) {
+            std::string path = "compaction_retry_test/level_1_" + std::to_string(id) + ".sst";
+            std::filesystem::create_directory(path);
+            std::ofstream(path + "/keep");
+        }
+        options.level0_compaction_trigger = 2;
+        log.str("");
+        cerr_buf = std::cerr.rdbuf(log.rdbuf());
+        {
+            KVStore store("compaction_retry_test/wal.log", "compaction_retry_test", options);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+            for (int id = 1; id <= 100; id++) {
+                std::filesystem::remove_all("compaction_retry_test/level_1_" + std::to_string(id) + ".sst");
+            }
+            auto level0Tables = [] {
+                size_t count = 0;
+                for (const auto &entry : std::filesystem::directory_iterator("compaction_retry_test")) {
+                    count += entry.path().filename().string().rfind("level_0_", 0) == 0;
+                }
+                return count;
+            };
+            for (int wait = 0; wait < 50 && level0Tables() > 0; wait++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            assert(level0Tables() == 0);
+            for (int i = 0; i < 250; i++) {
+                assert(store.get(key(i)) == "value_" + std::to_string(i));
+            }
+        }
+        std::cerr.rdbuf(cerr_buf);
+        size_t failures = countLines(log.str(), "aborted");
+        assert(failures >= 1 && failures <= 4);
+        std::cout << "✓ Failed compactions back off" << std::endl;
+    }
+
     std::cout << "\n=== ALL TESTS PASSED ===" << std::endl;
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,320 @@
+#include "manifest.h"
+#include "checksum.h"
+#include "format.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <iterator>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+const char *const Manifest::FILENAME = "MANIFEST";
+
+namespace
+{
+// Each edit is a sequence of tagged fields
+enum Tag : uint32_t
+{
+    NEXT_FILE_ID = 1,
+    // varint32 level, varint32 file id
+    REMOVED_TABLE = 2,
+    // varint32 level, varint32 file id, filename, varint64 size, min key, max key,
+    // varint64 largest sequence; strings are length-prefixed
+    ADDED_TABLE = 3,
+    // Fields of ADDED_TABLE: a table the store left out because it could not be read
+    UNLOADED_TABLE = 4
+};
+
+const size_t RECORD_HEADER_SIZE = 8;
+
+struct DecodedEdit
+{
+    std::vector<ManifestTable> added;
+    std::vector<std::pair<int, int>> removed;
+    uint32_t next_file_id = 0;
+};
+
+void encodeTable(std::string &dst, const ManifestTable &table)
+{
+    putVarint32(dst, table.unloaded ? UNLOADED_TABLE : ADDED_TABLE);
+    putVarint32(dst, table.level);
+    putVarint32(dst, table.fileId);
+    putLengthPrefixed(dst, table.filename);
+    putVarint64(dst, table.fileSize);
+    putLengthPrefixed(dst, table.minKey);
+    putLengthPrefixed(dst, table.maxKey);
+    putVarint64(dst, table.largestSequence);
+}
+
+void encodeTable(std::string &dst, int level, const SSTableMetadata &sst)
+{
+    encodeTable(dst, {level, sst.fileId, fs::path(sst.filename).filename().string(), static_cast<uint64_t>(sst.fileSize), sst.minKey, sst.maxKey, sst.largestSequence});
+}
+
+bool decodeEdit(std::string_view input, DecodedEdit &edit)
+{
+    while (!input.empty())
+    {
+        uint32_t tag;
+        if (!getVarint32(input, tag))
+        {
+            return false;
+        }
+
+        uint32_t level, file_id;
+        switch (tag)
+        {
+        case NEXT_FILE_ID:
+            if (!getVarint32(input, edit.next_file_id))
+            {
+                return false;
+            }
+            break;
+        case REMOVED_TABLE:
+            if (!getVarint32(input, level) || !getVarint32(input, file_id))
+            {
+                return false;
+            }
+            edit.removed.push_back({static_cast<int>(level), static_cast<int>(file_id)});
+            break;
+        case ADDED_TABLE:
+        case UNLOADED_TABLE:
+        {
+            std::string_view name, min_key, max_key;
+            uint64_t size, largest_sequence;
+            if (!getVarint32(input, level) || !getVarint32(input, file_id) || !getLengthPrefixed(input, name) || !getVarint64(input, size) ||
+                !getLengthPrefixed(input, min_key) || !getLengthPrefixed(input, max_key) || !getVarint64(input, largest_sequence))
+            {
+                return false;
+            }
+            edit.added.push_back({static_cast<int>(level), static_cast<int>(file_id), std::string(name), size, std::string(min_key), std::string(max_key), largest_sequence,
+                                  tag == UNLOADED_TABLE});
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string encodeRecord(const std::string &payload)
+{
+    std::string record;
+    record.reserve(RECORD_HEADER_SIZE + payload.size());
+    putFixed32(record, crc32c(payload));
+    putFixed32(record, payload.size());
+    record.append(payload);
+    return record;
+}
+
+bool writeAll(int fd, const std::string &data)
+{
+    const char *ptr = data.data();
+    size_t remaining = data.size();
+
+    while (remaining > 0)
+    {
+        ssize_t written = ::write(fd, ptr, remaining);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        ptr += written;
+        remaining -= written;
+    }
+
+    return true;
+}
+
+bool syncFile(int fd)
+{
+#ifdef __APPLE__
+    return ::fcntl(fd, F_FULLFSYNC) == 0;
+#else
+    return ::fdatasync(fd) == 0;
+#endif
+}
+
+// Makes a rename in the directory durable
+bool syncDirectory(const std::string &directory)
+{
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+}
+
+Manifest::Manifest(const std::string &directory)
+    : directory(directory), filename((fs::path(directory) / FILENAME).string())
+{
+}
+
+Manifest::~Manifest()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+}
+
+Manifest::Status Manifest::recover(std::vector<ManifestTable> &tables, int &next_file_id) const
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        return Status::Missing;
+    }
+
+    std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::string_view input(contents);
+
+    // Keyed by file id, which is unique across levels
+    std::map<int, ManifestTable> live;
+    uint32_t next_id = 1;
+
+    while (input.size() >= RECORD_HEADER_SIZE)
+    {
+        uint32_t crc = decodeFixed32(input.data());
+        uint32_t length = decodeFixed32(input.data() + 4);
+        if (input.size() - RECORD_HEADER_SIZE < length)
+        {
+            break;
+        }
+
+        std::string_view payload = input.substr(RECORD_HEADER_SIZE, length);
+        input.remove_prefix(RECORD_HEADER_SIZE + length);
+
+        DecodedEdit edit;
+        if (crc32c(payload) != crc || !decodeEdit(payload, edit))
+        {
+            if (input.empty())
+            {
+                break;
+            }
+            std::cerr << "Corrupt record in " << filename << std::endl;
+            return Status::Corrupt;
+        }
+
+        for (const auto &[level, file_id] : edit.removed)
+        {
+            live.erase(file_id);
+        }
+        for (auto &table : edit.added)
+        {
+            live[table.fileId] = std::move(table);
+        }
+        next_id = std::max(next_id, edit.next_file_id);
+    }
+
+    tables.clear();
+    for (auto &[file_id, table] : live)
+    {
+        tables.push_back(std::move(table));
+        next_id = std::max<uint32_t>(next_id, file_id + 1);
+    }
+    next_file_id = next_id;
+
+    return Status::Ok;
+}
+
+bool Manifest::create(const Version &version, int next_file_id, const std::vector<ManifestTable> &unloaded)
+{
+    std::string payload;
+    putVarint32(payload, NEXT_FILE_ID);
+    putVarint32(payload, next_file_id);
+    for (size_t level = 0; level < version.numLevels(); ++level)
+    {
+        for (const auto &sst : version.files(level))
+        {
+            encodeTable(payload, level, *sst);
+        }
+    }
+    for (const auto &table : unloaded)
+    {
+        encodeTable(payload, table);
+    }
+
+    std::string temp_name = filename + ".tmp";
+    int temp_fd = ::open(temp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (temp_fd < 0)
+    {
+        std::cerr << "Failed to create " << temp_name << std::endl;
+        return false;
+    }
+
+    bool ok = writeAll(temp_fd, encodeRecord(payload)) && syncFile(temp_fd);
+    ::close(temp_fd);
+
+    if (!ok || std::rename(temp_name.c_str(), filename.c_str()) != 0 || !syncDirectory(directory))
+    {
+        std::cerr << "Failed to write " << filename << std::endl;
+        ::unlink(temp_name.c_str());
+        return false;
+    }
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    fd = ::open(filename.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open " << filename << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool Manifest::append(const VersionEdit &edit, int next_file_id)
+{
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    std::string payload;
+    putVarint32(payload, NEXT_FILE_ID);
+    putVarint32(payload, next_file_id);
+    for (const auto &[level, file_id] : edit.removed)
+    {
+        putVarint32(payload, REMOVED_TABLE);
+        putVarint32(payload, level);
+        putVarint32(payload, file_id);
+    }
+    for (const auto &[level, sst] : edit.added)
+    {
+        encodeTable(payload, level, *sst);
+    }
+
+    // A partly written record is cut off again, so it cannot end up in the middle of the log
+    off_t end = ::lseek(fd, 0, SEEK_END);
+    if (end < 0 || !writeAll(fd, encodeRecord(payload)) || !syncFile(fd))
+    {
+        std::cerr << "Failed to append to " << filename << std::endl;
+        if (end >= 0 && ::ftruncate(fd, end) != 0)
+        {
+            std::cerr << "Failed to truncate " << filename << std::endl;
+        }
+        return false;
+    }
+
+    return true;
+}
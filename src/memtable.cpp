@@ -1,59 +1,412 @@
 #include "memtable.h"
-#include <iostream>
+#include <random>
+#include <thread>
+#include <new>
+#include <cstring>
 
-MemTable::MemTable() {}
+MemTable::MemTable() : arena(std::make_unique<Arena>()), max_height(1), num_entries(0), num_range_tombstones(0)
+{
+    head = newNode("", MAX_HEIGHT);
+}
+
+MemTable::~MemTable() {}
+
+MemTable::Node *MemTable::newNode(std::string_view key, int height)
+{
+    // Node, its tower of next pointers and the key bytes live in one arena allocation
+    size_t node_bytes = sizeof(Node) + sizeof(std::atomic<Node *>) * (height - 1);
+    char *mem = arena->allocate(node_bytes + key.size());
+
+    char *key_data = mem + node_bytes;
+    std::memcpy(key_data, key.data(), key.size());
+
+    Node *node = new (mem) Node{key_data, static_cast<uint32_t>(key.size()), height, {nullptr}, {}};
+    for (int i = 0; i < height; i++)
+    {
+        new (&node->next[i]) std::atomic<Node *>(nullptr);
+    }
+
+    return node;
+}
+
+MemTable::ValueNode *MemTable::newValue(std::string_view value, ValueType type, uint64_t sequence)
+{
+    char *mem = arena->allocate(sizeof(ValueNode) + value.size());
+
+    char *data = mem + sizeof(ValueNode);
+    std::memcpy(data, value.data(), value.size());
+
+    return new (mem) ValueNode{data, static_cast<uint32_t>(value.size()), type, sequence, {nullptr}};
+}
+
+int MemTable::randomHeight()
+{
+    thread_local std::minstd_rand rng(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+    // Branching factor of 4
+    int height = 1;
+    while (height < MAX_HEIGHT && (rng() & 3) == 0)
+    {
+        height++;
+    }
+    return height;
+}
+
+void MemTable::setValue(Node *node, ValueNode *value)
+{
+    std::atomic<ValueNode *> *link = &node->value;
+    ValueNode *current = link->load(std::memory_order_acquire);
+
+    while (true)
+    {
+        // Versions are never unlinked, so skipping past newer ones is safe without a lock
+        while (current != nullptr && current->sequence > value->sequence)
+        {
+            link = &current->prev;
+            current = link->load(std::memory_order_acquire);
+        }
+
+        value->prev.store(current, std::memory_order_relaxed);
+        if (link->compare_exchange_weak(current, value, std::memory_order_release, std::memory_order_acquire))
+        {
+            return;
+        }
+    }
+}
+
+const MemTable::ValueNode *MemTable::versionAt(const Node *node, uint64_t snapshot)
+{
+    const ValueNode *version = node->value.load(std::memory_order_acquire);
+    while (version != nullptr && version->sequence > snapshot)
+    {
+        version = version->prev.load(std::memory_order_acquire);
+    }
+    return version;
+}
+
+void MemTable::write(std::string_view key, ValueNode *value)
+{
+    Node *prev[MAX_HEIGHT];
+    Node *next[MAX_HEIGHT];
+
+    // Find the splice at every level, top down
+    Node *x = head;
+    for (int level = MAX_HEIGHT - 1; level >= 0; level--)
+    {
+        Node *n = x->getNext(level);
+        while (n != nullptr && n->key() < key)
+        {
+            x = n;
+            n = x->getNext(level);
+        }
+        prev[level] = x;
+        next[level] = n;
+    }
+
+    if (next[0] != nullptr && next[0]->key() == key)
+    {
+        setValue(next[0], value);
+        return;
+    }
+
+    int height = randomHeight();
+    int current_max = max_height.load(std::memory_order_relaxed);
+    while (height > current_max && !max_height.compare_exchange_weak(current_max, height))
+    {
+    }
+
+    Node *node = newNode(key, height);
+    node->value.store(value, std::memory_order_relaxed);
+
+    for (int level = 0; level < height; level++)
+    {
+        while (true)
+        {
+            node->next[level].store(next[level], std::memory_order_relaxed);
+
+            if (prev[level]->next[level].compare_exchange_strong(next[level], node, std::memory_order_release, std::memory_order_acquire))
+            {
+                break;
+            }
+
+            // Another insert won the race at this level; walk forward from the old splice
+            Node *n = prev[level]->getNext(level);
+            while (n != nullptr && n->key() < key)
+            {
+                prev[level] = n;
+                n = n->getNext(level);
+            }
+            next[level] = n;
+
+            if (level == 0 && n != nullptr && n->key() == key)
+            {
+                // The same key was linked concurrently; write through to that node instead.
+                // The unlinked node stays in the arena until the table is released.
+                setValue(n, value);
+                return;
+            }
+        }
+    }
+
+    num_entries.fetch_add(1, std::memory_order_relaxed);
+}
+
+MemTable::Node *MemTable::findGreaterOrEqual(std::string_view key) const
+{
+    Node *x = head;
+    int level = max_height.load(std::memory_order_relaxed) - 1;
+
+    while (true)
+    {
+        Node *next = x->getNext(level);
+        if (next != nullptr && next->key() < key)
+        {
+            x = next;
+        }
+        else if (level == 0)
+        {
+            return next;
+        }
+        else
+        {
+            level--;
+        }
+    }
+}
+
+MemTable::Node *MemTable::findLessThan(std::string_view key) const
+{
+    Node *x = head;
+    int level = max_height.load(std::memory_order_relaxed) - 1;
+
+    while (true)
+    {
+        Node *next = x->getNext(level);
+        if (next != nullptr && next->key() < key)
+        {
+            x = next;
+        }
+        else if (level == 0)
+        {
+            return x == head ? nullptr : x;
+        }
+        else
+        {
+            level--;
+        }
+    }
+}
+
+MemTable::Node *MemTable::findLast() const
+{
+    Node *x = head;
+    int level = max_height.load(std::memory_order_relaxed) - 1;
+
+    while (true)
+    {
+        Node *next = x->getNext(level);
+        if (next != nullptr)
+        {
+            x = next;
+        }
+        else if (level == 0)
+        {
+            return x == head ? nullptr : x;
+        }
+        else
+        {
+            level--;
+        }
+    }
+}
 
-MemTable::~MemTable()
+void MemTable::put(std::string_view key, std::string_view value, uint64_t sequence, ValueType type)
 {
-    table.clear();
+    write(key, newValue(value, type, sequence));
 }
 
-void MemTable::put(const std::string &key, const std::string &value)
+bool MemTable::hiddenAt(const std::vector<RangeTombstone> &ranges, std::string_view key, uint64_t sequence, uint64_t snapshot)
 {
-    std::unique_lock<std::shared_mutex> lock(rw_mutex);
-    table[key] = value;
+    for (const auto &range : ranges)
+    {
+        if (range.sequence > sequence && range.sequence <= snapshot && range.covers(key))
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
-std::optional<std::string> MemTable::get(const std::string &key) const
+bool MemTable::get(std::string_view key, uint64_t snapshot, std::string &value, ValueType &type) const
 {
-    std::shared_lock<std::shared_mutex> lock(rw_mutex);
+    Node *node = findGreaterOrEqual(key);
+    const ValueNode *version = nullptr;
 
-    auto iterator = table.find(key);
+    if (node != nullptr && node->key() == key)
+    {
+        version = versionAt(node, snapshot);
+    }
+
+    if (num_range_tombstones.load(std::memory_order_acquire) > 0)
+    {
+        std::lock_guard<std::mutex> lock(range_mutex);
+        if (hiddenAt(range_tombstones, key, version ? version->sequence : 0, snapshot))
+        {
+            type = ValueType::Deletion;
+            return true;
+        }
+    }
 
-    if (iterator != table.end())
+    if (version == nullptr)
     {
-        return iterator->second;
+        return false;
     }
 
-    return std::nullopt;
-};
+    type = version->type;
+    if (type == ValueType::Value)
+    {
+        value.assign(version->data, version->size);
+    }
+    return true;
+}
 
-void MemTable::remove(const std::string &key)
+void MemTable::remove(std::string_view key, uint64_t sequence)
 {
-    std::unique_lock<std::shared_mutex> lock(rw_mutex);
+    write(key, newValue("", ValueType::Deletion, sequence));
+}
 
-    table.erase(key);
+void MemTable::deleteRange(std::string_view begin, std::string_view end, uint64_t sequence)
+{
+    std::lock_guard<std::mutex> lock(range_mutex);
+    range_tombstones.push_back({std::string(begin), std::string(end), sequence});
+    num_range_tombstones.store(range_tombstones.size(), std::memory_order_release);
+}
+
+std::vector<RangeTombstone> MemTable::rangeTombstones() const
+{
+    if (num_range_tombstones.load(std::memory_order_acquire) == 0)
+    {
+        return {};
+    }
+
+    std::lock_guard<std::mutex> lock(range_mutex);
+    return range_tombstones;
+}
+
+void MemTable::forEachVersion(const VersionHandler &handler) const
+{
+    for (const Node *node = head->getNext(0); node != nullptr; node = node->getNext(0))
+    {
+        for (const ValueNode *version = node->value.load(std::memory_order_acquire); version != nullptr;
+             version = version->prev.load(std::memory_order_acquire))
+        {
+            handler(node->key(), version->view(), version->type, version->sequence);
+        }
+    }
 }
 
 size_t MemTable::size() const
 {
-    std::shared_lock<std::shared_mutex> lock(rw_mutex);
+    return num_entries.load(std::memory_order_relaxed);
+}
 
-    return table.size();
+bool MemTable::empty() const
+{
+    return size() == 0 && num_range_tombstones.load(std::memory_order_acquire) == 0;
+}
+
+size_t MemTable::memoryUsage() const
+{
+    return arena->memoryUsage();
 }
 
 void MemTable::clear()
 {
-    std::unique_lock<std::shared_mutex> lock(rw_mutex);
+    arena = std::make_unique<Arena>();
+
+    head = newNode("", MAX_HEIGHT);
+    max_height = 1;
+    num_entries = 0;
+
+    std::lock_guard<std::mutex> lock(range_mutex);
+    range_tombstones.clear();
+    num_range_tombstones = 0;
+}
+
+MemTable::Iterator::Iterator(const MemTable *table, uint64_t snapshot)
+    : table(table), snapshot(snapshot), node(nullptr), version(nullptr)
+{
+    ranges = table->rangeTombstones();
+}
+
+bool MemTable::Iterator::valid() const
+{
+    return node != nullptr;
+}
+
+void MemTable::Iterator::seekToFirst()
+{
+    node = table->head->getNext(0);
+    skipHidden();
+}
+
+void MemTable::Iterator::seekToLast()
+{
+    node = table->findLast();
+    skipHiddenBackward();
+}
 
-    table.clear();
+void MemTable::Iterator::seek(std::string_view key)
+{
+    node = table->findGreaterOrEqual(key);
+    skipHidden();
 }
 
-std::map<std::string, std::string> MemTable::flush()
+void MemTable::Iterator::next()
 {
-    std::unique_lock<std::shared_mutex> lock(rw_mutex);
+    node = node->getNext(0);
+    skipHidden();
+}
 
-    std::map<std::string, std::string> data = std::move(table);
+void MemTable::Iterator::prev()
+{
+    node = table->findLessThan(node->key());
+    skipHiddenBackward();
+}
 
-    return data;
-}
\ No newline at end of file
+std::string_view MemTable::Iterator::key() const
+{
+    return node->key();
+}
+
+std::string_view MemTable::Iterator::value() const
+{
+    return version->view();
+}
+
+ValueType MemTable::Iterator::type() const
+{
+    return version->type;
+}
+
+bool MemTable::Iterator::visible()
+{
+    version = versionAt(node, snapshot);
+    return version != nullptr && (ranges.empty() || !hiddenAt(ranges, node->key(), version->sequence, snapshot));
+}
+
+void MemTable::Iterator::skipHidden()
+{
+    while (node != nullptr && !visible())
+    {
+        node = node->getNext(0);
+    }
+}
+
+void MemTable::Iterator::skipHiddenBackward()
+{
+    while (node != nullptr && !visible())
+    {
+        node = table->findLessThan(node->key());
+    }
+}
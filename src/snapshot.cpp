@@ -0,0 +1,49 @@
+#include "snapshot.h"
+#include "format.h"
+#include <algorithm>
+
+const Snapshot *SnapshotList::acquire(const std::atomic<uint64_t> &visible_sequence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    snapshots.push_back(Snapshot(visible_sequence.load(std::memory_order_acquire)));
+    return &snapshots.back();
+}
+
+void SnapshotList::release(const Snapshot *snapshot)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = snapshots.begin(); it != snapshots.end(); ++it)
+    {
+        if (&*it == snapshot)
+        {
+            snapshots.erase(it);
+            return;
+        }
+    }
+}
+
+std::vector<uint64_t> SnapshotList::sequences() const
+{
+    std::vector<uint64_t> result;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &snapshot : snapshots)
+        {
+            result.push_back(snapshot.sequence());
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+bool versionVisible(const std::vector<uint64_t> &snapshots, uint64_t sequence, uint64_t upper)
+{
+    // Current reads behave as a snapshot at MAX_SEQUENCE_NUMBER
+    if (upper > MAX_SEQUENCE_NUMBER)
+    {
+        return true;
+    }
+
+    auto it = std::lower_bound(snapshots.begin(), snapshots.end(), sequence);
+    return it != snapshots.end() && *it < upper;
+}
@@ -1,160 +1,552 @@
 #include "sstable.h"
+#include "block.h"
+#include "checksum.h"
+#include "snapshot.h"
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
 
-std::vector<IndexEntry> SSTable::flush(const std::map<std::string, std::string> &data, const std::string &filename, BloomFilter &bf)
+namespace
 {
-    std::ofstream file(filename, std::ios::binary);
-    std::vector<IndexEntry> sparse_index;
+const int LEGACY_BLOCK_ENTRIES = 100;
 
-    if (!file.is_open())
+bool syncFile(const std::string &filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
     {
-        std::cerr << "Failed to open SSTable file: " << filename << std::endl;
-        return sparse_index;
+        return false;
+    }
+#ifdef __APPLE__
+    bool ok = ::fcntl(fd, F_FULLFSYNC) == 0;
+#else
+    bool ok = ::fdatasync(fd) == 0;
+#endif
+    ::close(fd);
+    return ok;
+}
+
+bool searchBlock(std::string_view block, uint32_t format_version, const std::string &key, uint64_t snapshot, std::string &value, ValueType &type, uint64_t *sequence)
+{
+    BlockIterator iter(block, format_version);
+    iter.seek(key);
+
+    // Versions are newest first and never straddle blocks
+    while (iter.valid() && iter.key() == key && iter.sequence() > snapshot)
+    {
+        iter.next();
+    }
+
+    if (iter.valid() && iter.key() == key)
+    {
+        value = iter.value();
+        type = iter.type();
+        if (sequence)
+        {
+            *sequence = iter.sequence();
+        }
+        return true;
+    }
+
+    return false;
+}
+
+std::vector<IndexEntry>::const_iterator findBlock(const std::vector<IndexEntry> &index, const std::string &key)
+{
+    // First block whose last key is >= key
+    return std::lower_bound(index.begin(), index.end(), key, [](const IndexEntry &e, const std::string &k)
+                            { return e.key < k; });
+}
+
+bool readBlock(std::ifstream &file, const BlockHandle &handle, std::string &out)
+{
+    out.resize(handle.size);
+    file.clear();
+    file.seekg(handle.offset);
+    return static_cast<bool>(file.read(&out[0], handle.size));
+}
+
+// Reads a meta block and strips its trailer, verifying the checksum if there is one
+bool readMetaBlock(std::ifstream &file, const BlockHandle &handle, uint32_t format_version, std::string &out)
+{
+    size_t trailer = SSTable::metaBlockTrailerSize(format_version);
+    std::string_view contents;
+    std::shared_ptr<std::string> decoded;
+
+    if (!readBlock(file, {handle.offset, handle.size + trailer}, out) ||
+        !SSTable::decodeBlock(out, trailer, true, contents, decoded) || decoded)
+    {
+        return false;
     }
 
+    out.resize(contents.size());
+    return true;
+}
+
+std::vector<IndexEntry> loadLegacyIndex(std::ifstream &file, BloomFilter &bf, TableProperties &props, int bits_per_key)
+{
+    std::vector<IndexEntry> sparse_index;
+    std::vector<std::string> keys;
+
     long current_offset = 0;
+    long block_start = 0;
     int counter = 0;
-    int BLOCK_SIZE = 100;
+    std::string key;
 
-    for (const auto &[key, value] : data)
+    while (file.peek() != EOF)
     {
-        int key_len = key.size();
-        int value_len = value.size();
+        int key_len = 0;
+        file.read(reinterpret_cast<char *>(&key_len), sizeof(key_len));
+
+        if (file.eof())
+            break;
+
+        key.assign(key_len, '\0');
+        file.read(&key[0], key_len);
+
+        int value_len = 0;
+        file.read(reinterpret_cast<char *>(&value_len), sizeof(value_len));
+
+        file.seekg(value_len, std::ios::cur);
+
+        keys.push_back(key);
 
-        if (counter % BLOCK_SIZE == 0)
+        if (counter == 0)
         {
-            sparse_index.push_back({key, current_offset});
+            props.min_key = key;
         }
 
-        file.write(reinterpret_cast<const char *>(&key_len), sizeof(key_len));
-        file.write(key.c_str(), key_len);
+        props.num_entries++;
+        props.raw_key_size += key_len;
+        props.raw_value_size += value_len;
 
-        file.write(reinterpret_cast<const char *>(&value_len), sizeof(value_len));
-        file.write(value.c_str(), value_len);
+        current_offset = file.tellg();
+        counter++;
 
-        bf.add(key);
+        if (counter % LEGACY_BLOCK_ENTRIES == 0)
+        {
+            sparse_index.push_back({key, block_start, current_offset - block_start});
+            block_start = current_offset;
+        }
+    }
 
-        current_offset += (sizeof(int) + key.size() + sizeof(int) + value.size());
-        counter++;
+    if (current_offset > block_start)
+    {
+        sparse_index.push_back({key, block_start, current_offset - block_start});
     }
 
-    file.close();
+    if (!keys.empty())
+    {
+        bf = BloomFilter(keys.size(), bits_per_key);
+        for (const auto &k : keys)
+        {
+            bf.add(k);
+        }
+    }
+
+    props.format_version = SSTable::LEGACY_FORMAT_VERSION;
+    props.num_data_blocks = sparse_index.size();
+    props.data_size = current_offset;
+    props.max_key = key;
 
     return sparse_index;
-};
+}
+}
 
-std::vector<IndexEntry> SSTable::flush(const std::vector<std::pair<std::string, std::string>> &data, const std::string &filename, BloomFilter &bf)
+std::string TableProperties::encode() const
 {
-    std::ofstream file(filename, std::ios::binary);
-    std::vector<IndexEntry> sparse_index;
+    std::string data;
+    putVarint64(data, num_entries);
+    putVarint64(data, num_data_blocks);
+    putVarint64(data, raw_key_size);
+    putVarint64(data, raw_value_size);
+    putVarint64(data, data_size);
+    putLengthPrefixed(data, min_key);
+    putLengthPrefixed(data, max_key);
+    putVarint64(data, num_range_deletions);
+    range_deletions.encodeTo(data);
+    putVarint64(data, largest_sequence);
+    return data;
+}
+
+bool TableProperties::decode(std::string_view data)
+{
+    std::string_view min, max;
+    if (!getVarint64(data, num_entries) || !getVarint64(data, num_data_blocks) ||
+        !getVarint64(data, raw_key_size) || !getVarint64(data, raw_value_size) ||
+        !getVarint64(data, data_size) || !getLengthPrefixed(data, min) || !getLengthPrefixed(data, max))
+    {
+        return false;
+    }
+    min_key = min;
+    max_key = max;
+
+    // Tables from before range deletions end here, and those from before sequence numbers after them
+    if (!data.empty() && (!getVarint64(data, num_range_deletions) || !range_deletions.decodeFrom(data)))
+    {
+        return false;
+    }
+    if (!data.empty() && !getVarint64(data, largest_sequence))
+    {
+        return false;
+    }
+    return true;
+}
 
+SSTableWriter::SSTableWriter(const std::string &filename, BloomFilter &bf, const TableBuilderOptions &options)
+    : file(filename, std::ios::binary), filename(filename), bf(bf), options(options), block(options.restart_interval)
+{
     if (!file.is_open())
     {
         std::cerr << "Failed to open SSTable file: " << filename << std::endl;
-        return sparse_index;
     }
 
-    long current_offset = 0;
-    int counter = 0;
-    int BLOCK_SIZE = 100;
+    props.format_version = SSTable::FORMAT_VERSION;
+}
+
+bool SSTableWriter::ok() const
+{
+    return file.good();
+}
+
+void SSTableWriter::add(std::string_view key, std::string_view value, ValueType type, uint64_t sequence)
+{
+    // A block is only cut between keys, so every version of a key is in one block
+    if (block.sizeEstimate() >= options.block_size && key != last_key)
+    {
+        flushBlock();
+    }
+
+    block.add(key, value, type, sequence);
+    last_key.assign(key.data(), key.size());
+
+    if (props.num_entries == 0)
+    {
+        props.min_key = last_key;
+    }
+
+    props.num_entries++;
+    props.raw_key_size += key.size();
+    props.raw_value_size += value.size();
+    props.largest_sequence = std::max(props.largest_sequence, sequence);
+    bf.add(last_key);
+}
+
+void SSTableWriter::addRangeTombstone(const RangeTombstone &tombstone)
+{
+    range_tombstones.push_back(tombstone);
+}
 
-    for (const auto &[key, value] : data)
+BlockHandle SSTableWriter::writeRaw(std::string_view data)
+{
+    BlockHandle handle;
+    handle.offset = offset;
+    handle.size = data.size();
+
+    file.write(data.data(), data.size());
+    offset += data.size();
+
+    return handle;
+}
+
+BlockHandle SSTableWriter::writeBlock(std::string_view data, CompressionType type)
+{
+    std::string trailer(1, static_cast<char>(type));
+    uint32_t crc = crc32c_update(crc32c(data), reinterpret_cast<const uint8_t *>(trailer.data()), 1);
+    putFixed32(trailer, crc);
+
+    BlockHandle handle = writeRaw(data);
+    writeRaw(trailer);
+    return handle;
+}
+
+void SSTableWriter::flushBlock()
+{
+    if (block.empty())
     {
-        int key_len = key.size();
-        int value_len = value.size();
+        return;
+    }
+
+    std::string_view raw = block.finish();
+    std::string_view stored = raw;
+    CompressionType type = CompressionType::None;
 
-        if (counter % BLOCK_SIZE == 0)
+    if (options.compression != CompressionType::None)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool worthwhile = compressBlock(options.compression, raw, compressed) && compressed.size() < raw.size() - raw.size() / 8;
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+        if (worthwhile)
         {
-            sparse_index.push_back({key, current_offset});
+            stored = compressed;
+            type = options.compression;
         }
 
-        file.write(reinterpret_cast<const char *>(&key_len), sizeof(key_len));
-        file.write(key.c_str(), key_len);
+        if (options.stats)
+        {
+            options.stats->recordCompress(raw.size(), stored.size(), worthwhile, elapsed.count());
+        }
+    }
 
-        file.write(reinterpret_cast<const char *>(&value_len), sizeof(value_len));
-        file.write(value.c_str(), value_len);
+    BlockHandle handle = writeBlock(stored, type);
+    sparse_index.push_back({last_key, static_cast<long>(handle.offset), static_cast<long>(handle.size)});
+    props.num_data_blocks++;
+    block.reset();
+}
 
-        bf.add(key);
+bool SSTableWriter::finish()
+{
+    flushBlock();
 
-        current_offset += (sizeof(int) + key.size() + sizeof(int) + value.size());
-        counter++;
+    props.data_size = offset;
+    props.max_key = last_key;
+
+    if (!range_tombstones.empty())
+    {
+        for (const auto &tombstone : range_tombstones)
+        {
+            if (props.num_entries == 0 && props.num_range_deletions == 0)
+            {
+                props.min_key = tombstone.begin;
+                props.max_key = tombstone.end;
+            }
+            props.min_key = std::min(props.min_key, tombstone.begin);
+            props.max_key = std::max(props.max_key, tombstone.end);
+            props.largest_sequence = std::max(props.largest_sequence, tombstone.sequence);
+            props.num_range_deletions++;
+        }
+        props.range_deletions = writeBlock(encodeRangeTombstones(range_tombstones), CompressionType::None);
+    }
+
+    Footer footer;
+    footer.version = SSTable::FORMAT_VERSION;
+    footer.filter = writeBlock(bf.encode(), CompressionType::None);
+    footer.properties = writeBlock(props.encode(), CompressionType::None);
+
+    std::string index_block;
+    for (const auto &entry : sparse_index)
+    {
+        putLengthPrefixed(index_block, entry.key);
+        BlockHandle handle{static_cast<uint64_t>(entry.offset), static_cast<uint64_t>(entry.size)};
+        handle.encodeTo(index_block);
     }
+    footer.index = writeBlock(index_block, CompressionType::None);
 
+    writeRaw(footer.encode());
     file.close();
 
+    // The table must be durable before a MANIFEST record can refer to it
+    return !file.fail() && syncFile(filename);
+}
+
+const std::vector<IndexEntry> &SSTableWriter::index() const
+{
     return sparse_index;
 }
 
-std::vector<IndexEntry> SSTable::loadIndex(const std::string &filename, BloomFilter &bf)
+const TableProperties &SSTableWriter::properties() const
 {
-    std::ifstream file(filename, std::ios::binary);
-    std::vector<IndexEntry> sparse_index;
+    return props;
+}
 
-    if (!file.is_open())
+bool SSTable::flush(const MemTable &memtable, const std::vector<uint64_t> &snapshots, const std::string &filename, BloomFilter &bf, const TableBuilderOptions &options, std::vector<IndexEntry> &index, TableProperties *props)
+{
+    SSTableWriter writer(filename, bf, options);
+
+    if (!writer.ok())
     {
-        std::cerr << "Failed to open SSTable file: " << filename << std::endl;
-        return sparse_index;
+        return false;
     }
 
-    long current_offset = 0;
-    int counter = 0;
-    int BLOCK_SIZE = 100;
+    std::vector<RangeTombstone> tombstones = memtable.rangeTombstones();
+    std::string_view current_key;
+    uint64_t newer = MAX_SEQUENCE_NUMBER + 1;
 
-    while (file.peek() != EOF)
+    // Keeps each key's newest version plus the older ones a live snapshot still reads
+    memtable.forEachVersion([&](std::string_view key, std::string_view value, ValueType type, uint64_t sequence)
+                            {
+        if (key != current_key)
+        {
+            current_key = key;
+            newer = MAX_SEQUENCE_NUMBER + 1;
+        }
+
+        uint64_t upper = tombstones.empty() ? newer : std::min(newer, hiddenFrom(tombstones, key, sequence));
+        if (versionVisible(snapshots, sequence, upper))
+        {
+            writer.add(key, value, type, sequence);
+        }
+        newer = sequence; });
+
+    for (const auto &tombstone : tombstones)
     {
-        long entry_offset = current_offset;
+        writer.addRangeTombstone(tombstone);
+    }
 
-        int key_len = 0;
-        file.read(reinterpret_cast<char *>(&key_len), sizeof(key_len));
+    if (!writer.finish())
+    {
+        std::cerr << "Failed to write SSTable file: " << filename << std::endl;
+        return false;
+    }
 
-        if (file.eof())
-            break;
+    if (props)
+    {
+        *props = writer.properties();
+    }
 
-        std::string key(key_len, '\0');
-        file.read(&key[0], key_len);
+    index = writer.index();
+    return true;
+}
 
-        int value_len = 0;
-        file.read(reinterpret_cast<char *>(&value_len), sizeof(value_len));
+bool SSTable::flush(const std::vector<TableEntry> &entries, const std::vector<RangeTombstone> &range_tombstones, const std::string &filename, BloomFilter &bf, const TableBuilderOptions &options, std::vector<IndexEntry> &index, TableProperties *props)
+{
+    SSTableWriter writer(filename, bf, options);
 
-        file.seekg(value_len, std::ios::cur);
+    if (!writer.ok())
+    {
+        return false;
+    }
+
+    for (const auto &entry : entries)
+    {
+        writer.add(entry.key, entry.value, entry.type, entry.sequence);
+    }
+
+    for (const auto &tombstone : range_tombstones)
+    {
+        writer.addRangeTombstone(tombstone);
+    }
+
+    if (!writer.finish())
+    {
+        std::cerr << "Failed to write SSTable file: " << filename << std::endl;
+        return false;
+    }
+
+    if (props)
+    {
+        *props = writer.properties();
+    }
 
-        bf.add(key);
+    index = writer.index();
+    return true;
+}
+
+bool SSTable::readFooter(std::string_view contents, Footer &footer)
+{
+    if (contents.size() < Footer::ENCODED_LENGTH)
+    {
+        return false;
+    }
+
+    return footer.decode(contents.substr(contents.size() - Footer::ENCODED_LENGTH));
+}
+
+bool SSTable::readFooter(std::ifstream &file, Footer &footer)
+{
+    file.clear();
+    file.seekg(0, std::ios::end);
+    std::streamoff file_size = file.tellg();
+
+    if (file_size < static_cast<std::streamoff>(Footer::ENCODED_LENGTH))
+    {
+        return false;
+    }
+
+    std::string data(Footer::ENCODED_LENGTH, '\0');
+    file.seekg(file_size - Footer::ENCODED_LENGTH);
+    if (!file.read(&data[0], data.size()))
+    {
+        return false;
+    }
+
+    return footer.decode(data);
+}
 
-        if (counter % BLOCK_SIZE == 0)
+bool SSTable::decodeIndex(std::string_view input, std::vector<IndexEntry> &index)
+{
+    while (!input.empty())
+    {
+        std::string_view key;
+        BlockHandle handle;
+        if (!getLengthPrefixed(input, key) || !handle.decodeFrom(input))
         {
-            sparse_index.push_back({key, entry_offset});
+            return false;
         }
-
-        current_offset = file.tellg();
-        counter++;
+        index.push_back({std::string(key), static_cast<long>(handle.offset), static_cast<long>(handle.size)});
     }
+    return true;
+}
 
-    file.close();
-    return sparse_index;
+size_t SSTable::blockTrailerSize(uint32_t format_version)
+{
+    if (format_version >= 5)
+    {
+        return 1 + sizeof(uint32_t);
+    }
+    return format_version == 4 ? 1 : 0;
 }
 
-bool SSTable::search(const std::string &filename, const std::vector<IndexEntry> &index, const std::string &key, std::string &value)
+size_t SSTable::metaBlockTrailerSize(uint32_t format_version)
 {
-    auto entry = std::upper_bound(index.begin(), index.end(), key, [](const std::string &k, const IndexEntry &e)
-                                  { return k < e.key; });
+    return format_version >= 5 ? 1 + sizeof(uint32_t) : 0;
+}
 
-    if (entry == index.begin())
+bool SSTable::decodeBlock(std::string_view stored, size_t trailer_size, bool verify_checksum, std::string_view &contents, std::shared_ptr<std::string> &decoded, CompressionStats *stats)
+{
+    if (stored.size() < trailer_size)
     {
         return false;
     }
 
-    auto block_start = std::prev(entry);
-    long start_offset = block_start->offset;
+    contents = stored.substr(0, stored.size() - trailer_size);
+    if (trailer_size == 0)
+    {
+        return true;
+    }
+
+    if (verify_checksum && trailer_size > 1)
+    {
+        std::string_view checked = stored.substr(0, contents.size() + 1);
+        if (crc32c(checked) != decodeFixed32(stored.data() + checked.size()))
+        {
+            return false;
+        }
+    }
+
+    CompressionType type = static_cast<CompressionType>(stored[contents.size()]);
+    if (type == CompressionType::None)
+    {
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    decoded = std::make_shared<std::string>();
+    if (!uncompressBlock(type, contents, *decoded))
+    {
+        decoded.reset();
+        return false;
+    }
 
-    long end_offset = -1;
-    if (entry != index.end())
+    if (stats)
     {
-        end_offset = entry->offset;
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        stats->recordDecompress(elapsed.count());
     }
 
+    contents = *decoded;
+    return true;
+}
+
+bool SSTable::loadIndex(const std::string &filename, std::vector<IndexEntry> &sparse_index, BloomFilter &bf, TableProperties *props, int legacy_bits_per_key, std::vector<RangeTombstone> *range_tombstones)
+{
     std::ifstream file(filename, std::ios::binary);
+    TableProperties table_props;
+    sparse_index.clear();
 
     if (!file.is_open())
     {
@@ -162,37 +554,211 @@ bool SSTable::search(const std::string &filename, const std::vector<IndexEntry>
         return false;
     }
 
-    file.seekg(start_offset);
+    Footer footer;
+    if (!readFooter(file, footer))
+    {
+        file.clear();
+        file.seekg(0);
+        sparse_index = loadLegacyIndex(file, bf, table_props, legacy_bits_per_key);
+    }
+    else
+    {
+        std::string block;
 
-    while (file.peek() != EOF)
+        if (footer.version <= LEGACY_FORMAT_VERSION || footer.version > FORMAT_VERSION || !readMetaBlock(file, footer.index, footer.version, block))
+        {
+            std::cerr << "Unsupported or corrupt SSTable: " << filename << std::endl;
+            return false;
+        }
+
+        if (!decodeIndex(block, sparse_index))
+        {
+            std::cerr << "Corrupt index block in SSTable: " << filename << std::endl;
+            sparse_index.clear();
+            return false;
+        }
+
+        // Filters from before the blocked layout don't decode; the table then keeps a match-all filter
+        if (!readMetaBlock(file, footer.filter, footer.version, block))
+        {
+            std::cerr << "Corrupt filter block in SSTable: " << filename << std::endl;
+        }
+        else if (!BloomFilter::decode(block, bf))
+        {
+            bf = BloomFilter();
+        }
+
+        // Without the properties the table's range tombstones could not be found
+        if (!readMetaBlock(file, footer.properties, footer.version, block) || !table_props.decode(block))
+        {
+            std::cerr << "Corrupt properties block in SSTable: " << filename << std::endl;
+            sparse_index.clear();
+            return false;
+        }
+        table_props.format_version = footer.version;
+
+        if (range_tombstones && table_props.num_range_deletions > 0 &&
+            (!readMetaBlock(file, table_props.range_deletions, footer.version, block) || !decodeRangeTombstones(block, *range_tombstones, footer.version >= 7)))
+        {
+            std::cerr << "Corrupt range deletion block in SSTable: " << filename << std::endl;
+            sparse_index.clear();
+            return false;
+        }
+    }
+
+    if (props)
+    {
+        *props = table_props;
+    }
+
+    return true;
+}
+
+bool SSTable::search(const std::string &filename, const std::vector<IndexEntry> &index, const std::string &key, std::string &value, ValueType &type, BlockCache *cache, uint64_t file_id, uint32_t format_version, bool verify_checksums, uint64_t snapshot, uint64_t *sequence)
+{
+    auto entry = findBlock(index, key);
+
+    if (entry == index.end())
+    {
+        return false;
+    }
+
+    BlockCache::Block block = cache ? cache->lookup(file_id, entry->offset) : nullptr;
+
+    if (!block)
     {
-        if (end_offset != -1 && file.tellg() >= end_offset)
+        std::ifstream file(filename, std::ios::binary);
+
+        if (!file.is_open())
         {
-            break;
+            std::cerr << "Failed to open SSTable file: " << filename << std::endl;
+            return false;
         }
 
-        int key_len = 0;
-        int value_len = 0;
+        std::string stored;
+        uint64_t stored_size = entry->size + blockTrailerSize(format_version);
+        std::string_view contents;
+        std::shared_ptr<std::string> decoded;
 
-        file.read(reinterpret_cast<char *>(&key_len), sizeof(key_len));
+        if (!readBlock(file, {static_cast<uint64_t>(entry->offset), stored_size}, stored))
+        {
+            return false;
+        }
 
-        if (file.eof())
-            break;
+        if (!decodeBlock(stored, blockTrailerSize(format_version), verify_checksums, contents, decoded))
+        {
+            std::cerr << "Corrupt data block at offset " << entry->offset << " in SSTable: " << filename << std::endl;
+            return false;
+        }
 
-        std::string current_key(key_len, '\0');
-        file.read(&current_key[0], key_len);
+        block = decoded ? std::move(decoded) : std::make_shared<std::string>(contents);
+        if (cache)
+        {
+            cache->insert(file_id, entry->offset, block);
+        }
+    }
 
-        file.read(reinterpret_cast<char *>(&value_len), sizeof(value_len));
+    return searchBlock(*block, format_version, key, snapshot, value, type, sequence);
+}
 
-        std::string current_value(value_len, '\0');
-        file.read(&current_value[0], value_len);
+bool SSTable::search(const TableReader &table, const std::vector<IndexEntry> &index, const std::string &key, std::string &value, ValueType &type, uint64_t snapshot, uint64_t *sequence)
+{
+    auto entry = findBlock(index, key);
+
+    if (entry == index.end())
+    {
+        return false;
+    }
+
+    BlockContents block;
+    if (!table.readBlock(entry->offset, entry->size, block))
+    {
+        return false;
+    }
+
+    return searchBlock(block.data, table.formatVersion(), key, snapshot, value, type, sequence);
+}
+
+void SSTable::searchMany(const TableReader &table, const std::vector<IndexEntry> &index, const std::string_view *keys, size_t count, bool *found, std::string *values, ValueType *types, uint64_t snapshot, uint64_t *sequences)
+{
+    auto block = index.begin();
+    size_t i = 0;
+
+    while (i < count)
+    {
+        block = std::lower_bound(block, index.end(), keys[i], [](const IndexEntry &e, std::string_view k)
+                                 { return e.key < k; });
+        if (block == index.end())
+        {
+            return;
+        }
 
-        if (current_key == key)
+        BlockContents contents;
+        if (!table.readBlock(block->offset, block->size, contents))
         {
-            value = current_value;
-            return true;
+            return;
+        }
+
+        BlockIterator iter(contents.data, table.formatVersion());
+        iter.seekToFirst();
+
+        // Every key up to the block's last key is answered from this block; the cursor only
+        // moves forward, jumping through the restart array when the next key is further on
+        for (; i < count && keys[i] <= block->key; i++)
+        {
+            if (iter.valid() && iter.key() < keys[i])
+            {
+                iter.next();
+                if (iter.valid() && iter.key() < keys[i])
+                {
+                    iter.seek(keys[i]);
+                }
+            }
+
+            while (iter.valid() && iter.key() == keys[i] && iter.sequence() > snapshot)
+            {
+                iter.next();
+            }
+
+            if (iter.valid() && iter.key() == keys[i])
+            {
+                found[i] = true;
+                values[i] = iter.value();
+                types[i] = iter.type();
+                sequences[i] = iter.sequence();
+            }
         }
     }
+}
 
-    return false;
-}
\ No newline at end of file
+bool SSTable::nextRecord(std::string_view &input, std::string_view &key, std::string_view &value)
+{
+    int key_len = 0;
+    int value_len = 0;
+
+    if (input.size() < sizeof(key_len))
+    {
+        return false;
+    }
+    std::copy(input.data(), input.data() + sizeof(key_len), reinterpret_cast<char *>(&key_len));
+    input.remove_prefix(sizeof(key_len));
+
+    if (key_len < 0 || input.size() < key_len + sizeof(value_len))
+    {
+        return false;
+    }
+    key = input.substr(0, key_len);
+    input.remove_prefix(key_len);
+
+    std::copy(input.data(), input.data() + sizeof(value_len), reinterpret_cast<char *>(&value_len));
+    input.remove_prefix(sizeof(value_len));
+
+    if (value_len < 0 || input.size() < static_cast<size_t>(value_len))
+    {
+        return false;
+    }
+    value = input.substr(0, value_len);
+    input.remove_prefix(value_len);
+
+    return true;
+}
@@ -0,0 +1,178 @@
+#include "tablecache.h"
+#include "sstable.h"
+#include <iostream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+std::shared_ptr<TableReader> TableReader::open(const std::string &filename, uint64_t file_id, const TableReaderOptions &options)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    size_t size = st.st_size;
+    const char *data = nullptr;
+
+    if (size > 0)
+    {
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            std::cerr << "Failed to mmap SSTable file: " << filename << std::endl;
+            ::close(fd);
+            return nullptr;
+        }
+        data = static_cast<const char *>(mapped);
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+
+    return std::shared_ptr<TableReader>(new TableReader(filename, data, size, file_id, options));
+}
+
+TableReader::TableReader(const std::string &filename, const char *data, size_t size, uint64_t file_id, const TableReaderOptions &options)
+    : filename(filename), data(data), size(size), file_id(file_id), options(options)
+{
+    Footer footer;
+    format_version = SSTable::readFooter(contents(), footer) ? footer.version : SSTable::LEGACY_FORMAT_VERSION;
+}
+
+uint32_t TableReader::formatVersion() const
+{
+    return format_version;
+}
+
+TableReader::~TableReader()
+{
+    if (data)
+    {
+        munmap(const_cast<char *>(data), size);
+    }
+}
+
+std::string_view TableReader::contents() const
+{
+    return std::string_view(data, size);
+}
+
+std::string_view TableReader::block(uint64_t offset, uint64_t length) const
+{
+    if (offset > size || length > size - offset)
+    {
+        return std::string_view();
+    }
+    return std::string_view(data + offset, length);
+}
+
+bool TableReader::readBlock(uint64_t offset, uint64_t length, BlockContents &out, bool fill_cache) const
+{
+    size_t trailer = SSTable::blockTrailerSize(format_version);
+    std::string_view stored = block(offset, length + trailer);
+    if (stored.size() != length + trailer)
+    {
+        return false;
+    }
+
+    // Raw blocks are used in place; only compressed ones go through the block cache,
+    // and a cached block was verified when it was inserted
+    bool compressed = trailer > 0 && static_cast<CompressionType>(stored[length]) != CompressionType::None;
+    if (compressed && options.block_cache)
+    {
+        if (auto cached = options.block_cache->lookup(file_id, offset))
+        {
+            out.owned = std::move(cached);
+            out.data = *out.owned;
+            return true;
+        }
+    }
+
+    std::shared_ptr<std::string> decoded;
+    if (!SSTable::decodeBlock(stored, trailer, options.verify_checksums, out.data, decoded, options.stats))
+    {
+        std::cerr << "Corrupt data block at offset " << offset << " in SSTable: " << filename << std::endl;
+        return false;
+    }
+
+    out.owned = decoded;
+    if (decoded && options.block_cache && fill_cache)
+    {
+        options.block_cache->insert(file_id, offset, out.owned);
+    }
+    return true;
+}
+
+bool TableReader::readMetaBlock(uint64_t offset, uint64_t length, std::string_view &out) const
+{
+    size_t trailer = SSTable::metaBlockTrailerSize(format_version);
+    std::string_view stored = block(offset, length + trailer);
+    std::shared_ptr<std::string> decoded;
+
+    return stored.size() == length + trailer && SSTable::decodeBlock(stored, trailer, true, out, decoded) && !decoded;
+}
+
+TableCache::TableCache(size_t max_open_files, const TableReaderOptions &options)
+    : max_open_files(std::max<size_t>(max_open_files, 1)), options(options)
+{
+}
+
+std::shared_ptr<TableReader> TableCache::get(int file_id, const std::string &filename)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = readers.find(file_id);
+        if (it != readers.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            return it->second->second;
+        }
+    }
+
+    // Map outside the lock; if another thread raced us, keep whichever got in first
+    auto reader = TableReader::open(filename, file_id, options);
+    if (!reader)
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = readers.find(file_id);
+    if (it != readers.end())
+    {
+        return it->second->second;
+    }
+
+    lru.emplace_front(file_id, reader);
+    readers[file_id] = lru.begin();
+
+    while (lru.size() > max_open_files)
+    {
+        readers.erase(lru.back().first);
+        lru.pop_back();
+    }
+
+    return reader;
+}
+
+void TableCache::evict(int file_id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = readers.find(file_id);
+    if (it != readers.end())
+    {
+        lru.erase(it->second);
+        readers.erase(it);
+    }
+}
@@ -0,0 +1,66 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(size_t numThreads)
+{
+    if (numThreads == 0)
+    {
+        numThreads = 1;
+    }
+
+    for (size_t i = 0; i < numThreads; i++)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_cv.notify_all();
+
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        tasks.push(std::move(task));
+    }
+    queue_cv.notify_one();
+}
+
+size_t ThreadPool::size() const
+{
+    return workers.size();
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [this]
+                          { return stopping || !tasks.empty(); });
+
+            if (tasks.empty())
+            {
+                return;
+            }
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,99 @@
+#include "version.h"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+TableHandle newTableHandle(SSTableMetadata *metadata, TableCache *table_cache)
+{
+    return TableHandle(metadata, [table_cache](const SSTableMetadata *sst)
+                       {
+                           if (sst->obsolete)
+                           {
+                               table_cache->evict(sst->fileId);
+
+                               std::error_code ec;
+                               if (!fs::remove(sst->filename, ec) && ec)
+                               {
+                                   std::cerr << "Failed to delete obsolete SSTable " << sst->filename << ": " << ec.message() << std::endl;
+                               }
+                           }
+                           delete sst;
+                       });
+}
+
+void VersionEdit::addFile(int level, TableHandle table)
+{
+    added.push_back({level, std::move(table)});
+}
+
+void VersionEdit::removeFile(int level, int file_id)
+{
+    removed.push_back({level, file_id});
+}
+
+Version::Version(std::vector<std::vector<TableHandle>> levels)
+    : levels(std::move(levels))
+{
+    sortLevels();
+}
+
+size_t Version::numLevels() const
+{
+    return levels.size();
+}
+
+const std::vector<TableHandle> &Version::files(size_t level) const
+{
+    static const std::vector<TableHandle> empty;
+    return level < levels.size() ? levels[level] : empty;
+}
+
+std::shared_ptr<const Version> Version::apply(const VersionEdit &edit) const
+{
+    auto version = std::make_shared<Version>();
+    version->levels = levels;
+
+    for (const auto &[level, file_id] : edit.removed)
+    {
+        if (level >= static_cast<int>(version->levels.size()))
+        {
+            continue;
+        }
+
+        auto &files = version->levels[level];
+        files.erase(std::remove_if(files.begin(), files.end(), [file_id](const TableHandle &sst)
+                                   { return sst->fileId == file_id; }),
+                    files.end());
+    }
+
+    for (const auto &[level, table] : edit.added)
+    {
+        if (level >= static_cast<int>(version->levels.size()))
+        {
+            version->levels.resize(level + 1);
+        }
+        version->levels[level].push_back(table);
+    }
+
+    version->sortLevels();
+    return version;
+}
+
+void Version::sortLevels()
+{
+    if (levels.empty())
+    {
+        levels.push_back({});
+    }
+
+    std::sort(levels[0].begin(), levels[0].end(), [](const TableHandle &a, const TableHandle &b)
+              { return a->fileId < b->fileId; });
+
+    for (size_t i = 1; i < levels.size(); ++i)
+    {
+        std::sort(levels[i].begin(), levels[i].end(), [](const TableHandle &a, const TableHandle &b)
+                  { return a->minKey < b->minKey; });
+    }
+}
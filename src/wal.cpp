@@ -1,198 +1,598 @@
 #include "wal.h"
 #include "checksum.h"
 #include <iostream>
+#include <fstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+// Upper bound on the bytes a single leader commits on behalf of its followers
+const size_t MAX_GROUP_BYTES = 1 << 20;
+
+int openLogFile(const std::string &path)
+{
+    return ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+bool syncFile(int fd)
+{
+#ifdef __APPLE__
+    return ::fcntl(fd, F_FULLFSYNC) == 0;
+#else
+    return ::fdatasync(fd) == 0;
+#endif
+}
+
+// Records are checksummed in chunks of about this many bytes during replay, and
+// a replay window spans this many chunks per verifying thread
+const size_t VERIFY_CHUNK_BYTES = 1 << 20;
+const size_t CHUNKS_PER_THREAD = 4;
+
+// Checksum a record of the given header version should carry; sequence is the
+// record's encoded sequence number, empty before version 4
+uint32_t recordChecksum(const WALRecordHeader &header, std::string_view sequence, std::string_view key, std::string_view value)
+{
+    const uint8_t *header_bytes = reinterpret_cast<const uint8_t *>(&header);
+    const uint8_t *key_bytes = reinterpret_cast<const uint8_t *>(key.data());
+    const uint8_t *value_bytes = reinterpret_cast<const uint8_t *>(value.data());
+    size_t covered = offsetof(WALRecordHeader, checksum);
+
+    // Version 1 records used table-driven CRC-32, stored inverted
+    if (header.version == 1)
+    {
+        uint32_t crc = crc32_update(0u, header_bytes, covered);
+        crc = crc32_update(crc, key_bytes, key.size());
+        crc = crc32_update(crc, value_bytes, value.size());
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    uint32_t crc = crc32c_update(0u, header_bytes, covered);
+    crc = crc32c_update(crc, reinterpret_cast<const uint8_t *>(sequence.data()), sequence.size());
+    crc = crc32c_update(crc, key_bytes, key.size());
+    return crc32c_update(crc, value_bytes, value.size());
+}
 
-WAL::WAL(const std::string &filename) : filename(filename)
+// A record located in the mapped log; its fields are views into the mapping
+struct LogRecord
 {
-    file_stream.open(filename, std::ios::in | std::ios::out | std::ios::app | std::ios::binary);
+    WALRecordHeader header;
+    std::string_view sequence;
+    std::string_view key;
+    std::string_view value;
+    size_t size;
+};
+
+// Frames the record at the front of input without checking its checksum.
+// Fails on a truncated record or a bad magic number.
+bool parseRecord(std::string_view input, LogRecord &record)
+{
+    if (input.size() < sizeof(WALRecordHeader))
+    {
+        return false;
+    }
+    std::memcpy(&record.header, input.data(), sizeof(WALRecordHeader));
+    if (record.header.magic != 0xDEADBEEF)
+    {
+        return false;
+    }
 
-    if (!file_stream.is_open())
+    size_t sequence_len = record.header.version >= 4 ? sizeof(uint64_t) : 0;
+    uint64_t size = sizeof(WALRecordHeader) + sequence_len + static_cast<uint64_t>(record.header.key_len) + record.header.value_len;
+    if (size > input.size())
+    {
+        return false;
+    }
+
+    record.sequence = input.substr(sizeof(WALRecordHeader), sequence_len);
+    record.key = input.substr(sizeof(WALRecordHeader) + sequence_len, record.header.key_len);
+    record.value = input.substr(sizeof(WALRecordHeader) + sequence_len + record.header.key_len, record.header.value_len);
+    record.size = size;
+    return true;
+}
+
+bool checksumMatches(const LogRecord &record)
+{
+    return recordChecksum(record.header, record.sequence, record.key, record.value) == record.header.checksum;
+}
+
+// Number of leading records whose checksums match. The records are split into
+// chunks of about VERIFY_CHUNK_BYTES that are checked on up to threads threads.
+size_t verifyRecords(const std::vector<LogRecord> &records, int threads)
+{
+    std::vector<size_t> chunk_starts;
+    size_t chunk_bytes = VERIFY_CHUNK_BYTES;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        if (chunk_bytes >= VERIFY_CHUNK_BYTES)
+        {
+            chunk_starts.push_back(i);
+            chunk_bytes = 0;
+        }
+        chunk_bytes += records[i].size;
+    }
+    chunk_starts.push_back(records.size());
+
+    size_t chunks = chunk_starts.size() - 1;
+    std::vector<size_t> first_bad(chunks, records.size());
+    auto verifyChunk = [&](size_t chunk)
+    {
+        for (size_t i = chunk_starts[chunk]; i < chunk_starts[chunk + 1]; i++)
+        {
+            if (!checksumMatches(records[i]))
+            {
+                first_bad[chunk] = i;
+                return;
+            }
+        }
+    };
+
+    size_t workers = std::min<size_t>(std::max(threads, 1), chunks);
+    if (workers <= 1)
+    {
+        for (size_t chunk = 0; chunk < chunks; chunk++)
+        {
+            verifyChunk(chunk);
+        }
+    }
+    else
+    {
+        std::atomic<size_t> next_chunk{0};
+        std::vector<std::thread> verifiers;
+        for (size_t t = 0; t < workers; t++)
+        {
+            verifiers.emplace_back([&]
+                                   {
+                                       for (size_t chunk = next_chunk++; chunk < chunks; chunk = next_chunk++)
+                                       {
+                                           verifyChunk(chunk);
+                                       } });
+        }
+        for (auto &verifier : verifiers)
+        {
+            verifier.join();
+        }
+    }
+
+    return *std::min_element(first_bad.begin(), first_bad.end());
+}
+
+// Hands the operations of one verified record to handler; a batch yields all of
+// its operations or, if it does not decode, none
+bool dispatchRecord(const LogRecord &record, const WAL::ReplayHandler &handler, size_t &count)
+{
+    uint64_t sequence = record.sequence.empty() ? 0 : decodeFixed64(record.sequence.data());
+    // Older records marked deletions with a sentinel value instead of a type
+    bool legacy = record.header.version < 3;
+
+    if (record.header.flags & WAL_FLAG_BATCH)
+    {
+        if (!WriteBatch::iterate(record.value, [](WriteBatch::OpType, std::string_view, std::string_view) {}))
+        {
+            return false;
+        }
+        WriteBatch::iterate(record.value, [&](WriteBatch::OpType op, std::string_view k, std::string_view v)
+                            {
+            ValueType type = ValueType::Value;
+            if (op == WriteBatch::OpType::Delete || (legacy && v == "TOMBSTONE"))
+            {
+                type = ValueType::Deletion;
+            }
+            else if (op == WriteBatch::OpType::DeleteRange)
+            {
+                type = ValueType::RangeDeletion;
+            }
+            handler(type, k, type == ValueType::Deletion ? std::string_view() : v, sequence);
+            count++;
+            if (sequence != 0)
+            {
+                sequence++;
+            } });
+        return true;
+    }
+
+    ValueType type = static_cast<ValueType>((record.header.flags & WAL_TYPE_MASK) >> WAL_TYPE_SHIFT);
+    std::string_view value = record.value;
+    if (legacy && value == "TOMBSTONE")
+    {
+        type = ValueType::Deletion;
+        value = std::string_view();
+    }
+    handler(type, record.key, value, sequence);
+    count++;
+    return true;
+}
+}
+
+WAL::WAL(const std::string &filename, WALSyncPolicy policy, int sync_interval_ms)
+    : filename(filename), sync_policy(policy), sync_interval_ms(sync_interval_ms)
+{
+    fd = openLogFile(filename);
+
+    if (fd < 0)
     {
         std::cerr << "Failed to open WAL file: " << filename << std::endl;
     }
+
+    if (sync_policy == WALSyncPolicy::Interval)
+    {
+        sync_thread = std::thread(&WAL::syncLoop, this);
+    }
 }
 
 WAL::~WAL()
 {
-    if (file_stream.is_open())
+    if (sync_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(sync_mutex);
+            stop_sync = true;
+        }
+        sync_cv.notify_one();
+        sync_thread.join();
+    }
+
+    if (fd >= 0)
     {
-        file_stream.close();
+        if (sync_policy != WALSyncPolicy::Never)
+        {
+            syncFile(fd);
+        }
+        ::close(fd);
     }
 }
 
-bool WAL::write(const std::string &key, const std::string &value)
+std::string WAL::encodeRecord(uint8_t flags, uint64_t sequence, std::string_view key, std::string_view value)
 {
-    std::lock_guard<std::mutex> lock(log_mutex);
-
     WALRecordHeader header;
 
     header.magic = 0xDEADBEEF;
-    header.version = 1;
-    header.flags = 0;
+    header.version = WAL_RECORD_VERSION;
+    header.flags = flags;
     header.reserved = 0;
     header.key_len = key.size();
     header.value_len = value.size();
+    header.checksum = 0;
 
-    const uint8_t* header_bytes = reinterpret_cast<const uint8_t*>(&header);
+    std::string record;
+    record.reserve(sizeof(WALRecordHeader) + sizeof(uint64_t) + key.size() + value.size());
+    record.append(reinterpret_cast<const char *>(&header), sizeof(WALRecordHeader));
+    putFixed64(record, sequence);
+    record.append(key);
+    record.append(value);
 
-    uint32_t crc = crc32_update(0u, header_bytes, 16);
+    // Covers the header up to the checksum field, then sequence, key and value in one pass
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(record.data());
+    uint32_t crc = crc32c_update(0u, bytes, offsetof(WALRecordHeader, checksum));
+    crc = crc32c_update(crc, bytes + sizeof(WALRecordHeader), record.size() - sizeof(WALRecordHeader));
 
-    crc = crc32_update(crc, reinterpret_cast<const uint8_t*>(key.data()), key.size());
-    crc = crc32_update(crc, reinterpret_cast<const uint8_t*>(value.data()), value.size());
+    std::memcpy(&record[offsetof(WALRecordHeader, checksum)], &crc, sizeof(crc));
 
-    header.checksum = crc ^ 0xFFFFFFFFu;
+    return record;
+}
 
-    file_stream.write(reinterpret_cast<const char *>(&header), sizeof(WALRecordHeader));
+bool WAL::appendToFile(const std::string &data)
+{
+    const char *ptr = data.data();
+    size_t remaining = data.size();
 
-    file_stream.write(key.data(), key.size());
-    file_stream.write(value.data(), value.size());
+    while (remaining > 0)
+    {
+        ssize_t written = ::write(fd, ptr, remaining);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        ptr += written;
+        remaining -= written;
+    }
 
-    file_stream.flush();
+    return true;
+}
 
-    return file_stream.good();
+bool WAL::write(const std::string &key, const std::string &value, ValueType type, uint64_t sequence)
+{
+    return commit(encodeRecord(static_cast<uint8_t>(type) << WAL_TYPE_SHIFT, sequence, key, value));
 }
 
-std::vector<std::pair<std::string, std::string>> WAL::readAll()
+bool WAL::write(const WriteBatch &batch, uint64_t sequence)
 {
-    std::lock_guard<std::mutex> lock(log_mutex);
+    return commit(encodeRecord(WAL_FLAG_BATCH, sequence, "", batch.contents()));
+}
 
-    file_stream.clear();
-    file_stream.seekg(0, std::ios::beg);
+bool WAL::commit(const std::string &record)
+{
+    PendingWrite w;
+    w.record = &record;
 
-    std::vector<std::pair<std::string, std::string>> results;
+    std::unique_lock<std::mutex> lock(log_mutex);
+    writers.push_back(&w);
 
-    while (true)
+    while (!w.done && &w != writers.front())
     {
-        WALRecordHeader header;
+        w.cv.wait(lock);
+    }
+
+    if (w.done)
+    {
+        return w.ok;
+    }
+
+    // We are the leader: commit our record plus everything queued behind it
+    PendingWrite *last_writer = &w;
+    std::string group;
+    size_t group_bytes = 0;
 
-        // we can't read the full header of record meaning it is either EOF or header was cut off due to crash
-        if (!file_stream.read(reinterpret_cast<char *>(&header), sizeof(WALRecordHeader))) 
+    for (PendingWrite *writer : writers)
+    {
+        if (writer != &w && group_bytes + writer->record->size() > MAX_GROUP_BYTES)
         {
             break;
         }
-        
-        // Validate that header magic number was not corrupted
-        if (header.magic != 0xDEADBEEF)
+        group_bytes += writer->record->size();
+        last_writer = writer;
+    }
+
+    const std::string *payload = &record;
+    if (last_writer != &w)
+    {
+        group.reserve(group_bytes);
+        for (PendingWrite *writer : writers)
         {
-            break;
+            group.append(*writer->record);
+            if (writer == last_writer)
+            {
+                break;
+            }
         }
+        payload = &group;
+    }
 
-        // key was truncated
-        std::string key(header.key_len, '\0');
-        if (!file_stream.read(&key[0], header.key_len)) {
-            break;
-        }
+    lock.unlock();
 
-        // value was truncated
-        std::string value(header.value_len, '\0');
-        if (!file_stream.read(&value[0], header.value_len)) {
-            break;
-        }
+    bool ok;
+    {
+        std::lock_guard<std::mutex> file_lock(file_mutex);
+
+        ok = fd >= 0 && appendToFile(*payload);
 
-        const uint8_t* header_bytes = reinterpret_cast<const uint8_t*>(&header);
+        if (ok && sync_policy == WALSyncPolicy::EveryCommit)
+        {
+            ok = syncFile(fd);
+        }
+        else if (ok)
+        {
+            unsynced = true;
+        }
+    }
 
-        // recalculate checksum using read record
-        uint32_t recalculated_crc = crc32_update(0u, header_bytes, 16);
+    lock.lock();
 
-        recalculated_crc = crc32_update(recalculated_crc, reinterpret_cast<const uint8_t*>(key.data()), key.size());
-        recalculated_crc = crc32_update(recalculated_crc, reinterpret_cast<const uint8_t*>(value.data()), value.size());
+    while (true)
+    {
+        PendingWrite *writer = writers.front();
+        writers.pop_front();
 
-        recalculated_crc = recalculated_crc ^ 0xFFFFFFFF;
+        if (writer != &w)
+        {
+            writer->ok = ok;
+            writer->done = true;
+            writer->cv.notify_one();
+        }
 
-        // compare calculated checksum and header.checksum
-        if (recalculated_crc != header.checksum) {
+        if (writer == last_writer)
+        {
             break;
         }
+    }
 
-        results.push_back({key, value});
+    if (!writers.empty())
+    {
+        writers.front()->cv.notify_one();
     }
 
-    return results;
+    return ok;
 }
 
-std::vector<std::pair<std::string, std::string>> WAL::readAllFromFile(const std::string &path) {
-    std::ifstream file(path, std::ios::binary);
-
-    std::vector<std::pair<std::string, std::string>> results;
+bool WAL::sync()
+{
+    int sync_fd;
+    {
+        std::lock_guard<std::mutex> file_lock(file_mutex);
+        if (fd < 0)
+        {
+            return false;
+        }
+        unsynced = false;
+        // Sync through a duplicate descriptor so leaders are not blocked behind the sync
+        sync_fd = ::dup(fd);
+    }
 
-    if (!file.is_open()) {
-        std::cerr << "Error: Could not open the file!" << std::endl;
-        return results;
+    if (sync_fd < 0)
+    {
+        return false;
     }
 
-    while (true)
+    bool ok = syncFile(sync_fd);
+    ::close(sync_fd);
+
+    return ok;
+}
+
+void WAL::syncLoop()
+{
+    std::unique_lock<std::mutex> lock(sync_mutex);
+
+    while (!stop_sync)
     {
-        WALRecordHeader header;
+        sync_cv.wait_for(lock, std::chrono::milliseconds(sync_interval_ms));
 
-        // we can't read the full header of record meaning it is either EOF or header was cut off due to crash
-        if (!file.read(reinterpret_cast<char *>(&header), sizeof(WALRecordHeader))) 
+        if (unsynced)
         {
-            break;
-        }
-        
-        // Validate that header magic number was not corrupted
-        if (header.magic != 0xDEADBEEF)
-        {
-            break;
+            lock.unlock();
+            sync();
+            lock.lock();
         }
+    }
+}
 
-        // key was truncated
-        std::string key(header.key_len, '\0');
-        if (!file.read(&key[0], header.key_len)) {
-            break;
-        }
+size_t WAL::replay(const ReplayHandler &handler, int verify_threads)
+{
+    std::lock_guard<std::mutex> file_lock(file_mutex);
 
-        // value was truncated
-        std::string value(header.value_len, '\0');
-        if (!file.read(&value[0], header.value_len)) {
-            break;
-        }
+    return replayFile(filename, handler, verify_threads);
+}
 
-        const uint8_t* header_bytes = reinterpret_cast<const uint8_t*>(&header);
+size_t WAL::replayFile(const std::string &path, const ReplayHandler &handler, int verify_threads, bool truncate_torn_tail)
+{
+    int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+    {
+        std::cerr << "Error: Could not open the file!" << std::endl;
+        return 0;
+    }
 
-        // recalculate checksum using read record
-        uint32_t recalculated_crc = crc32_update(0u, header_bytes, 16);
+    struct stat st;
+    if (fstat(file, &st) != 0 || st.st_size == 0)
+    {
+        ::close(file);
+        return 0;
+    }
 
-        recalculated_crc = crc32_update(recalculated_crc, reinterpret_cast<const uint8_t*>(key.data()), key.size());
-        recalculated_crc = crc32_update(recalculated_crc, reinterpret_cast<const uint8_t*>(value.data()), value.size());
+    size_t size = st.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+    // The mapping stays valid after the descriptor is closed
+    ::close(file);
+    if (mapped == MAP_FAILED)
+    {
+        std::cerr << "Failed to mmap WAL file: " << path << std::endl;
+        return 0;
+    }
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    std::string_view log(static_cast<const char *>(mapped), size);
+    size_t window_bytes = VERIFY_CHUNK_BYTES * CHUNKS_PER_THREAD * std::max(verify_threads, 1);
+    size_t count = 0;
+    size_t offset = 0;
+    // End of the last record handed over
+    size_t intact_end = 0;
+    bool intact = true;
+
+    // The log is framed, verified and replayed one window at a time, so only the
+    // window's record positions are held in memory. Replay stops at the first
+    // torn or corrupt record: nothing after it was acknowledged.
+    std::vector<LogRecord> window;
+    while (intact && offset < size)
+    {
+        window.clear();
+        size_t window_end = offset;
+        while (window_end - offset < window_bytes && window_end < size)
+        {
+            LogRecord record;
+            if (!parseRecord(log.substr(window_end), record))
+            {
+                intact = false;
+                break;
+            }
+            window.push_back(record);
+            window_end += record.size;
+        }
 
-        recalculated_crc = recalculated_crc ^ 0xFFFFFFFF;
+        size_t verified = verifyRecords(window, verify_threads);
+        intact = intact && verified == window.size();
 
-        // compare calculated checksum and header.checksum
-        if (recalculated_crc != header.checksum) {
-            break;
+        intact_end = offset;
+        for (size_t i = 0; i < verified; i++)
+        {
+            if (!dispatchRecord(window[i], handler, count))
+            {
+                intact = false;
+                break;
+            }
+            intact_end += window[i].size;
         }
+        offset = window_end;
+    }
 
-        results.push_back({key, value});
+    munmap(mapped, size);
+
+    if (truncate_torn_tail && intact_end < size)
+    {
+        int out = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        if (out < 0 || ::ftruncate(out, intact_end) != 0 || !syncFile(out))
+        {
+            std::cerr << "Failed to truncate the torn tail of WAL file: " << path << std::endl;
+        }
+        else
+        {
+            std::cerr << "Truncated WAL file " << path << " after its last intact record (" << size - intact_end << " bytes dropped)" << std::endl;
+        }
+        if (out >= 0)
+        {
+            ::close(out);
+        }
     }
 
-    return results;
+    return count;
 }
 
-void WAL::clear()
+std::vector<WALEntry> WAL::readAll()
 {
-    std::lock_guard<std::mutex> lock(log_mutex);
+    std::vector<WALEntry> results;
+    replay([&results](ValueType type, std::string_view key, std::string_view value, uint64_t sequence)
+           { results.push_back({type, std::string(key), std::string(value), sequence}); });
+    return results;
+}
 
-    file_stream.close();
+std::vector<WALEntry> WAL::readAllFromFile(const std::string &path)
+{
+    std::vector<WALEntry> results;
+    replayFile(path, [&results](ValueType type, std::string_view key, std::string_view value, uint64_t sequence)
+               { results.push_back({type, std::string(key), std::string(value), sequence}); });
+    return results;
+}
 
-    file_stream.open(filename, std::ios::out | std::ios::trunc);
-    file_stream.close();
+void WAL::clear()
+{
+    std::lock_guard<std::mutex> file_lock(file_mutex);
 
-    file_stream.open(filename, std::ios::in | std::ios::out | std::ios::app | std::ios::binary);
+    if (fd >= 0 && ::ftruncate(fd, 0) != 0)
+    {
+        std::cerr << "Failed to truncate WAL file: " << filename << std::endl;
+    }
 }
 
 void WAL::rotate()
 {
-    std::lock_guard<std::mutex> lock(log_mutex);
-    
-    file_stream.close();
-    
+    std::lock_guard<std::mutex> file_lock(file_mutex);
+
+    if (fd >= 0)
+    {
+        if (sync_policy != WALSyncPolicy::Never)
+        {
+            syncFile(fd);
+        }
+        ::close(fd);
+    }
+
     std::string temp_name = filename + ".tmp";
     std::rename(filename.c_str(), temp_name.c_str());
-    
-    file_stream.open(filename, std::ios::in | std::ios::out | std::ios::app | std::ios::binary);
-    
-    if (!file_stream.is_open())
+
+    fd = openLogFile(filename);
+    unsynced = false;
+
+    if (fd < 0)
     {
         std::cerr << "Failed to reopen WAL file after rotation: " << filename << std::endl;
     }
@@ -202,4 +602,4 @@ void WAL::clearTemp()
 {
     std::string temp_name = filename + ".tmp";
     std::remove(temp_name.c_str());
-}
\ No newline at end of file
+}
@@ -0,0 +1,101 @@
+#include "writebatch.h"
+#include "format.h"
+
+namespace
+{
+const size_t HEADER_SIZE = 4;
+}
+
+WriteBatch::WriteBatch()
+{
+    clear();
+}
+
+void WriteBatch::put(std::string_view key, std::string_view value)
+{
+    rep.push_back(static_cast<char>(OpType::Put));
+    putLengthPrefixed(rep, key);
+    putLengthPrefixed(rep, value);
+
+    std::string count_bytes;
+    putFixed32(count_bytes, count() + 1);
+    rep.replace(0, HEADER_SIZE, count_bytes);
+}
+
+void WriteBatch::remove(std::string_view key)
+{
+    rep.push_back(static_cast<char>(OpType::Delete));
+    putLengthPrefixed(rep, key);
+
+    std::string count_bytes;
+    putFixed32(count_bytes, count() + 1);
+    rep.replace(0, HEADER_SIZE, count_bytes);
+}
+
+void WriteBatch::deleteRange(std::string_view begin, std::string_view end)
+{
+    rep.push_back(static_cast<char>(OpType::DeleteRange));
+    putLengthPrefixed(rep, begin);
+    putLengthPrefixed(rep, end);
+
+    std::string count_bytes;
+    putFixed32(count_bytes, count() + 1);
+    rep.replace(0, HEADER_SIZE, count_bytes);
+}
+
+void WriteBatch::clear()
+{
+    rep.assign(HEADER_SIZE, '\0');
+}
+
+uint32_t WriteBatch::count() const
+{
+    return decodeFixed32(rep.data());
+}
+
+const std::string &WriteBatch::contents() const
+{
+    return rep;
+}
+
+bool WriteBatch::iterate(std::string_view rep, const Handler &handler)
+{
+    uint32_t count;
+    if (!getFixed32(rep, count))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (rep.empty())
+        {
+            return false;
+        }
+
+        OpType type = static_cast<OpType>(rep.front());
+        rep.remove_prefix(1);
+
+        std::string_view key, value;
+        if (!getLengthPrefixed(rep, key))
+        {
+            return false;
+        }
+
+        if (type == OpType::Put || type == OpType::DeleteRange)
+        {
+            if (!getLengthPrefixed(rep, value))
+            {
+                return false;
+            }
+        }
+        else if (type != OpType::Delete)
+        {
+            return false;
+        }
+
+        handler(type, key, value);
+    }
+
+    return rep.empty();
+}